@@ -0,0 +1,314 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+// Measures the AR SEI code of the patched codecparsers without an encoder: writing a message
+// with gst_h264_create_sei_memory / gst_h265_create_sei_memory, as msdkh26Xenc does for every
+// frame, and parsing the NAL unit again with gst_h26X_parser_parse_sei, as h26Xparse does.
+// Heap allocations are counted by interposing malloc, so the figures include those of GLib.
+
+#include <gst/codecparsers/gsth264parser.h>
+#include <gst/codecparsers/gsth265parser.h>
+#include <gst/gst.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Size of the label and object arrays of GstH26XAnnotatedRegions
+#define MAX_AR_ENTRIES 250
+
+namespace {
+
+std::atomic<size_t> allocated_bytes{0};
+std::atomic<size_t> allocations{0};
+
+} // namespace
+
+// glibc's own entry points, the definitions below take precedence over libc for the
+// whole process, GLib and GStreamer included
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocated_bytes.fetch_add(count * size, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) {
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+}
+}
+
+namespace {
+
+std::vector<int> object_counts = {1, 16, 64, 250};
+std::vector<int> label_counts = {0, 1, 16};
+int label_length = 16;
+int repeats = 2000;
+std::vector<std::string> codecs = {"h264", "h265"};
+
+struct H264 {
+    typedef GstH264SEIMessage Message;
+    typedef GstH264AnnotatedRegions AnnotatedRegions;
+    typedef GstH264NalParser Parser;
+    static const int PAYLOAD_TYPE = GST_H264_SEI_ANNOTATED_REGIONS;
+
+    static Parser *NewParser() {
+        return gst_h264_nal_parser_new();
+    }
+    static void FreeParser(Parser *parser) {
+        gst_h264_nal_parser_free(parser);
+    }
+    static GstMemory *Write(GArray *messages) {
+        return gst_h264_create_sei_memory(4, messages);
+    }
+    static GArray *Parse(Parser *parser, const guint8 *data, gsize size) {
+        GstH264NalUnit nalu;
+        GstH264ParserResult result = gst_h264_parser_identify_nal(parser, data, 0, size, &nalu);
+        // A single NAL unit ends with the data
+        if (result != GST_H264_PARSER_OK && result != GST_H264_PARSER_NO_NAL_END)
+            return NULL;
+        GArray *messages = NULL;
+        if (gst_h264_parser_parse_sei(parser, &nalu, &messages) != GST_H264_PARSER_OK) {
+            if (messages)
+                g_array_free(messages, TRUE);
+            return NULL;
+        }
+        return messages;
+    }
+};
+
+struct H265 {
+    typedef GstH265SEIMessage Message;
+    typedef GstH265AnnotatedRegions AnnotatedRegions;
+    typedef GstH265Parser Parser;
+    static const int PAYLOAD_TYPE = GST_H265_SEI_ANNOTATED_REGIONS;
+
+    static Parser *NewParser() {
+        return gst_h265_parser_new();
+    }
+    static void FreeParser(Parser *parser) {
+        gst_h265_parser_free(parser);
+    }
+    static GstMemory *Write(GArray *messages) {
+        return gst_h265_create_sei_memory(0, 1, 4, messages);
+    }
+    static GArray *Parse(Parser *parser, const guint8 *data, gsize size) {
+        GstH265NalUnit nalu;
+        GstH265ParserResult result = gst_h265_parser_identify_nal(parser, data, 0, size, &nalu);
+        if (result != GST_H265_PARSER_OK && result != GST_H265_PARSER_NO_NAL_END)
+            return NULL;
+        GArray *messages = NULL;
+        if (gst_h265_parser_parse_sei(parser, &nalu, &messages) != GST_H265_PARSER_OK) {
+            if (messages)
+                g_array_free(messages, TRUE);
+            return NULL;
+        }
+        return messages;
+    }
+};
+
+// A message as msdkh26Xenc writes it for the first frame: all labels and all objects with
+// boxes spread over a 4K frame and a confidence of 8 bits
+template <typename Codec>
+void FillMessage(typename Codec::Message &message, int objects, int labels) {
+    memset(&message, 0, sizeof(message));
+    message.payloadType = (decltype(message.payloadType))Codec::PAYLOAD_TYPE;
+    typename Codec::AnnotatedRegions &ar = message.payload.annotated_regions;
+    ar.object_label_present_flag = labels > 0;
+    ar.object_conf_info_present_flag = 1;
+    ar.object_conf_length = 8;
+    ar.num_labels = labels;
+    ar.num_label_updates = labels;
+    for (int i = 0; i < labels; i++) {
+        std::string label = "label" + std::to_string(i);
+        label.resize(label_length, 'x');
+        strcpy(ar.labels[i].label, label.c_str());
+    }
+    ar.num_object_updates = objects;
+    for (int i = 0; i < objects; i++) {
+        auto &object = ar.objects[i];
+        object.object_idx = i;
+        object.object_label_idx = labels ? i % labels : 0;
+        object.object_confidence = 128 + i % 128;
+        object.bounding_box_update_flag = 1;
+        object.bounding_box_top = (i * 97) % 2000;
+        object.bounding_box_left = (i * 181) % 3700;
+        object.bounding_box_width = 64 + i % 64;
+        object.bounding_box_height = 96 + i % 64;
+    }
+}
+
+struct Measurement {
+    double ns = 0;
+    double bytes = 0;
+    double allocations = 0;
+};
+
+template <typename F>
+Measurement Measure(F run) {
+    run();
+    size_t bytes_before = allocated_bytes.load(), allocations_before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+        run();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    Measurement measurement;
+    measurement.ns = elapsed.count() / repeats;
+    measurement.bytes = double(allocated_bytes.load() - bytes_before) / repeats;
+    measurement.allocations = double(allocations.load() - allocations_before) / repeats;
+    return measurement;
+}
+
+// Runs one case, returns false if the message doesn't survive writing and parsing
+template <typename Codec>
+bool RunCase(const char *codec, int objects, int labels) {
+    GArray *messages = g_array_new(FALSE, FALSE, sizeof(typename Codec::Message));
+    g_array_set_size(messages, 1);
+    FillMessage<Codec>(g_array_index(messages, typename Codec::Message, 0), objects, labels);
+
+    GstMemory *memory = Codec::Write(messages);
+    GstMapInfo map;
+    if (!memory || !gst_memory_map(memory, &map, GST_MAP_READ)) {
+        fprintf(stderr, "%s: can't write %d objects, %d labels\n", codec, objects, labels);
+        if (memory)
+            gst_memory_unref(memory);
+        g_array_free(messages, TRUE);
+        return false;
+    }
+    Measurement write = Measure([&] { gst_memory_unref(Codec::Write(messages)); });
+    typename Codec::Parser *parser = Codec::NewParser();
+
+    // The first parse checks what came back
+    GArray *parsed = Codec::Parse(parser, map.data, map.size);
+    bool ok = parsed && parsed->len == 1;
+    if (ok) {
+        const typename Codec::Message &message = g_array_index(parsed, typename Codec::Message, 0);
+        const typename Codec::AnnotatedRegions &ar = message.payload.annotated_regions;
+        ok = message.payloadType == Codec::PAYLOAD_TYPE && (int)ar.num_object_updates == objects &&
+             (int)ar.num_label_updates == labels;
+        for (int i = 0; ok && i < objects; i++)
+            ok = ar.objects[i].bounding_box_left ==
+                 g_array_index(messages, typename Codec::Message, 0).payload.annotated_regions.objects[i].bounding_box_left;
+    }
+    if (parsed)
+        g_array_free(parsed, TRUE);
+
+    Measurement parse;
+    if (ok)
+        parse = Measure([&] {
+            GArray *result = Codec::Parse(parser, map.data, map.size);
+            if (result)
+                g_array_free(result, TRUE);
+        });
+    else
+        fprintf(stderr, "%s: %d objects, %d labels don't parse back\n", codec, objects, labels);
+
+    printf("%-5s %7d %6d %6d %8zu %10.0f %10.0f %6.1f %10.0f %10.0f %6.1f\n", codec, objects, labels,
+           labels ? label_length : 0, map.size, write.ns, write.bytes, write.allocations, parse.ns, parse.bytes,
+           parse.allocations);
+
+    Codec::FreeParser(parser);
+    gst_memory_unmap(memory, &map);
+    gst_memory_unref(memory);
+    g_array_free(messages, TRUE);
+    return ok;
+}
+
+std::vector<int> ParseList(const char *list) {
+    std::vector<int> values;
+    for (const char *p = list; *p;) {
+        values.push_back(atoi(p));
+        p += strcspn(p, ",");
+        if (*p)
+            p++;
+    }
+    return values;
+}
+
+void Usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-c h264|h265] [-o object counts] [-l label counts] [-s label length] [-r repeats]\n",
+            name);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:o:l:s:r:")) != -1) {
+        switch (opt) {
+        case 'c':
+            codecs = {optarg};
+            break;
+        case 'o':
+            object_counts = ParseList(optarg);
+            break;
+        case 'l':
+            label_counts = ParseList(optarg);
+            break;
+        case 's':
+            label_length = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    bool valid = repeats > 0 && label_length > 0 && label_length < 250 && !object_counts.empty() &&
+                 !label_counts.empty() && (codecs[0] == "h264" || codecs[0] == "h265");
+    for (int objects : object_counts)
+        valid = valid && objects >= 1 && objects <= MAX_AR_ENTRIES;
+    for (int labels : label_counts)
+        valid = valid && labels >= 0 && labels <= MAX_AR_ENTRIES;
+    if (!valid) {
+        Usage(argv[0]);
+        fprintf(stderr, "Object counts 1 - %d, label counts 0 (no labels) - %d, label length 1 - 249\n",
+                MAX_AR_ENTRIES, MAX_AR_ENTRIES);
+        return 1;
+    }
+
+    printf("%d repeats, times in ns, allocations in bytes and count per message\n", repeats);
+    printf("%-5s %7s %6s %6s %8s %10s %10s %6s %10s %10s %6s\n", "codec", "objects", "labels", "length", "NAL size",
+           "write", "alloc", "count", "parse", "alloc", "count");
+    bool ok = true;
+    for (const std::string &codec : codecs)
+        for (int labels : label_counts)
+            for (int objects : object_counts)
+                ok = (codec == "h264" ? RunCase<H264>("h264", objects, labels)
+                                      : RunCase<H265>("h265", objects, labels)) &&
+                     ok;
+    return ok ? 0 : 1;
+}
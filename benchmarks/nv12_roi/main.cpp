@@ -0,0 +1,217 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+// Compares the fused NV12 region kernel with what classification_encode does without it:
+// videoconvert of the whole frame to BGRA, videoscale of every region to the model input
+// size and the conversion to a planar float tensor. The videoconvert and videoscale steps
+// are emulated with straightforward loops, so the baseline is a lower bound of the real
+// elements' cost.
+
+#include "nv12_roi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+int frame_width = 1920;
+int frame_height = 1080;
+int num_regions = 8;
+int region_size = 160;
+int model_size = 62;
+int repeats = 200;
+
+struct Frame {
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> uv;
+    Nv12Frame nv12;
+};
+
+// Smooth content with some noise, so the conversion sees realistic values
+void FillFrame(Frame &frame, int width, int height) {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> noise(-8, 8);
+    frame.y.resize((size_t)width * height);
+    frame.uv.resize((size_t)width * (height / 2));
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            frame.y[(size_t)y * width + x] = std::min(std::max(16 + (x + y) % 220 + noise(random), 0), 255);
+    for (int y = 0; y < height / 2; y++)
+        for (int x = 0; x < width / 2; x++) {
+            frame.uv[(size_t)y * width + 2 * x] = std::min(std::max(128 + (x % 64) - 32 + noise(random), 0), 255);
+            frame.uv[(size_t)y * width + 2 * x + 1] = std::min(std::max(128 + (y % 64) - 32 + noise(random), 0), 255);
+        }
+    frame.nv12 = {frame.y.data(), width, frame.uv.data(), width, width, height};
+}
+
+std::vector<FrameRegion> SpreadRegions(int width, int height) {
+    std::mt19937 random(2);
+    std::uniform_int_distribution<int> x(0, width - region_size), y(0, height - region_size);
+    std::vector<FrameRegion> regions;
+    for (int i = 0; i < num_regions; i++)
+        regions.push_back({x(random), y(random), region_size, region_size});
+    return regions;
+}
+
+uint8_t Clamp8(int v) {
+    return (uint8_t)std::min(std::max(v, 0), 255);
+}
+
+// videoconvert NV12 -> BGRA, BT.601 limited range in 8 bit fixed point
+void ConvertFrameToBgra(const Nv12Frame &frame, std::vector<uint8_t> &bgra) {
+    bgra.resize((size_t)frame.width * frame.height * 4);
+    for (int y = 0; y < frame.height; y++) {
+        const uint8_t *luma = frame.y + (size_t)y * frame.y_stride;
+        const uint8_t *uv = frame.uv + (size_t)(y / 2) * frame.uv_stride;
+        uint8_t *out = bgra.data() + (size_t)y * frame.width * 4;
+        for (int x = 0; x < frame.width; x++) {
+            int c = 298 * (luma[x] - 16), d = uv[x & ~1] - 128, e = uv[x | 1] - 128;
+            out[4 * x] = Clamp8((c + 516 * d + 128) >> 8);
+            out[4 * x + 1] = Clamp8((c - 100 * d - 208 * e + 128) >> 8);
+            out[4 * x + 2] = Clamp8((c + 409 * e + 128) >> 8);
+            out[4 * x + 3] = 255;
+        }
+    }
+}
+
+// videoscale of a BGRA region, bilinear, followed by the planar float conversion of the inference element
+void ResizeBgraToPlanar(const std::vector<uint8_t> &bgra, int width, const FrameRegion &region, int out_width,
+                        int out_height, std::vector<uint8_t> &scaled, float *tensor) {
+    scaled.resize((size_t)out_width * out_height * 4);
+    for (int oy = 0; oy < out_height; oy++) {
+        float sy = std::min(std::max((oy + 0.5f) * region.h / out_height - 0.5f, 0.0f), region.h - 1.0f);
+        int y0 = (int)sy, y1 = std::min(y0 + 1, region.h - 1);
+        float fy = sy - y0;
+        for (int ox = 0; ox < out_width; ox++) {
+            float sx = std::min(std::max((ox + 0.5f) * region.w / out_width - 0.5f, 0.0f), region.w - 1.0f);
+            int x0 = (int)sx, x1 = std::min(x0 + 1, region.w - 1);
+            float fx = sx - x0;
+            const uint8_t *p00 = &bgra[((size_t)(region.y + y0) * width + region.x + x0) * 4];
+            const uint8_t *p01 = &bgra[((size_t)(region.y + y0) * width + region.x + x1) * 4];
+            const uint8_t *p10 = &bgra[((size_t)(region.y + y1) * width + region.x + x0) * 4];
+            const uint8_t *p11 = &bgra[((size_t)(region.y + y1) * width + region.x + x1) * 4];
+            for (int c = 0; c < 4; c++) {
+                float top = p00[c] + fx * (p01[c] - p00[c]);
+                float bottom = p10[c] + fx * (p11[c] - p10[c]);
+                scaled[((size_t)oy * out_width + ox) * 4 + c] = (uint8_t)(top + fy * (bottom - top) + 0.5f);
+            }
+        }
+    }
+    size_t plane_size = (size_t)out_width * out_height;
+    for (size_t i = 0; i < plane_size; i++)
+        for (int c = 0; c < 3; c++)
+            tensor[c * plane_size + i] = scaled[i * 4 + c];
+}
+
+template <typename F>
+double MicrosecondsPerFrame(F run) {
+    run();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+        run();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / repeats;
+}
+
+float MaxDifference(const std::vector<float> &a, const std::vector<float> &b) {
+    float max = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        max = std::max(max, std::abs(a[i] - b[i]));
+    return max;
+}
+
+// The baseline rounds to 8 bit twice and upsamples chroma by repetition, so only the mean is comparable
+float MeanDifference(const std::vector<float> &a, const std::vector<float> &b) {
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        sum += std::abs(a[i] - b[i]);
+    return float(sum / a.size());
+}
+
+void Usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-w frame width] [-h frame height] [-n regions] [-s region size] "
+                    "[-m model input size] [-r repeats]\n",
+            name);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "w:h:n:s:m:r:")) != -1) {
+        switch (opt) {
+        case 'w':
+            frame_width = atoi(optarg);
+            break;
+        case 'h':
+            frame_height = atoi(optarg);
+            break;
+        case 'n':
+            num_regions = atoi(optarg);
+            break;
+        case 's':
+            region_size = atoi(optarg);
+            break;
+        case 'm':
+            model_size = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    frame_width &= ~1;
+    frame_height &= ~1;
+    if (frame_width <= 0 || frame_height <= 0 || num_regions <= 0 || model_size <= 0 || repeats <= 0 ||
+        region_size <= 0 || region_size > std::min(frame_width, frame_height)) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    Frame frame;
+    FillFrame(frame, frame_width, frame_height);
+    std::vector<FrameRegion> regions = SpreadRegions(frame_width, frame_height);
+    size_t tensor_size = regions.size() * 3 * model_size * model_size;
+
+    printf("%dx%d NV12, %d regions of %dx%d to %dx%d, %d repeats\n", frame_width, frame_height, num_regions,
+           region_size, region_size, model_size, model_size, repeats);
+
+    std::vector<uint8_t> bgra, scaled;
+    std::vector<float> baseline(tensor_size);
+    double baseline_us = MicrosecondsPerFrame([&] {
+        ConvertFrameToBgra(frame.nv12, bgra);
+        for (size_t n = 0; n < regions.size(); n++)
+            ResizeBgraToPlanar(bgra, frame_width, regions[n], model_size, model_size, scaled,
+                               baseline.data() + n * 3 * model_size * model_size);
+    });
+    printf("%-28s %10.1f us per frame\n", "videoconvert + videoscale", baseline_us);
+
+    std::vector<float> reference(tensor_size), tensor(tensor_size);
+    for (const char *kernel : {"scalar", "avx2", "avx512"}) {
+        if (!SetNv12RegionsKernel(kernel)) {
+            printf("%-28s %10s\n", kernel, "not supported");
+            continue;
+        }
+        std::vector<float> &out = std::string(kernel) == "scalar" ? reference : tensor;
+        double us = MicrosecondsPerFrame(
+            [&] { Nv12RegionsToPlanarBgr(frame.nv12, regions, model_size, model_size, out.data()); });
+        // SIMD kernels against the scalar one, and all against the 8 bit baseline
+        float simd_difference = &out == &reference ? 0.0f : MaxDifference(out, reference);
+        printf("%-28s %10.1f us per frame, %5.2fx, max difference %.4f to scalar, mean difference %.2f to baseline\n",
+               kernel, us, baseline_us / us, simd_difference, MeanDifference(out, baseline));
+    }
+    return 0;
+}
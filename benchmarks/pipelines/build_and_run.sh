@@ -0,0 +1,29 @@
+#!/bin/bash
+# ==============================================================================
+# Copyright (C) 2020 Intel Corporation
+#
+# SPDX-License-Identifier: MIT
+# ==============================================================================
+
+# Usage: ./build_and_run.sh [BASELINE_REPORT]
+# The build directory is kept, later runs only rebuild what changed and a report
+# can be kept as baseline: cp build/benchmark_report.json baseline.json
+
+BASE_DIR=$PWD
+BUILD_DIR=$BASE_DIR/build
+
+mkdir -p ${BUILD_DIR}
+cd ${BUILD_DIR}
+
+BASELINE=
+if [ -n "${1}" ]; then
+    BASELINE=$(realpath ${1})
+fi
+
+if [ -f /etc/lsb-release ]; then
+    cmake ${BASE_DIR} -DBENCHMARK_BASELINE=${BASELINE}
+else
+    cmake3 ${BASE_DIR} -DBENCHMARK_BASELINE=${BASELINE}
+fi
+
+make -j $(nproc) && make benchmark
@@ -0,0 +1,308 @@
+#!/usr/bin/env python3
+# ==============================================================================
+# Copyright (C) 2020 Intel Corporation
+#
+# SPDX-License-Identifier: MIT
+# ==============================================================================
+
+"""Runs the samples over the bundled clips and writes a JSON report.
+
+Every combination of sample, clip, codec and AR SEI insertion is run --repeats
+times. A run records the frame rate at the sinks (from the --stats file of the
+sample), wall and CPU time, peak RSS and the size of the encoded output. With
+--baseline the medians are compared against an earlier report and the script
+exits with 1 if any of them got worse by more than --tolerance.
+"""
+
+import argparse
+import glob
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+APPS = ("playback", "detect_encode", "classification_encode")
+CODECS = ("h264", "h265")
+
+# Raw input of detect_encode, the size the sample expects by default
+RAW_WIDTH = 768
+RAW_HEIGHT = 432
+
+# SEI payload type of annotated regions
+SEI_ANNOTATED_REGIONS = 202
+
+# Figures compared against the baseline: True if higher is better
+METRICS = {
+    "fps": True,
+    "cpu_s": False,
+    "peak_rss_mb": False,
+    "output_bytes": False,
+}
+
+
+def binary(bin_dir, app, sei):
+    # playback only decodes, the encoders are built once with and once without AR SEI
+    build = app if sei is None else "%s_sei%d" % (app, sei)
+    return os.path.join(bin_dir, build, app)
+
+
+def decode_raw(clip, codec, raw_dir):
+    """Decodes a clip to the I420 file detect_encode reads, once per build directory."""
+    raw = os.path.join(raw_dir, "%s_%dx%d.yuv" % (os.path.basename(clip), RAW_WIDTH, RAW_HEIGHT))
+    if os.path.exists(raw) and os.path.getmtime(raw) >= os.path.getmtime(clip):
+        return raw
+    os.makedirs(raw_dir, exist_ok=True)
+    subprocess.run(["gst-launch-1.0", "-q", "filesrc", "location=" + clip, "!", codec + "parse", "!",
+                    "msdk%sdec" % codec, "!", "videoconvert", "!", "videoscale", "!",
+                    "video/x-raw,format=I420,width=%d,height=%d" % (RAW_WIDTH, RAW_HEIGHT), "!",
+                    "filesink", "location=" + raw + ".tmp"], check=True)
+    os.replace(raw + ".tmp", raw)
+    return raw
+
+
+def annotated_regions_nal_units(data, h265):
+    """Counts the SEI NAL units with annotated regions, as AnnotatedRegionsSeiSize() of es_segmenter.cpp."""
+    header_size = 2 if h265 else 1
+    count = 0
+    start = data.find(b"\x00\x00\x01")
+    while start >= 0:
+        header = start + 3
+        end = data.find(b"\x00\x00\x01", header)
+        nal = data[header:end if end >= 0 else len(data)]
+        start = end
+        if len(nal) <= header_size:
+            continue
+        nal_type = (nal[0] >> 1) & 0x3f if h265 else nal[0] & 0x1f
+        if nal_type != (39 if h265 else 6):
+            continue
+        # Without the emulation prevention bytes
+        rbsp = nal[header_size:].replace(b"\x00\x00\x03", b"\x00\x00")
+        p = 0
+        # sei_message() until the rbsp trailing bits
+        while p < len(rbsp) and not (p + 1 == len(rbsp) and rbsp[p] == 0x80):
+            payload_type = payload_size = 0
+            while p < len(rbsp) and rbsp[p] == 0xff:
+                payload_type += 255
+                p += 1
+            if p == len(rbsp):
+                break
+            payload_type += rbsp[p]
+            p += 1
+            while p < len(rbsp) and rbsp[p] == 0xff:
+                payload_size += 255
+                p += 1
+            if p == len(rbsp):
+                break
+            payload_size += rbsp[p]
+            p += 1
+            if payload_type == SEI_ANNOTATED_REGIONS:
+                count += 1
+                break
+            p += payload_size
+    return count
+
+
+def cases(args):
+    """Yields (app, clip, codec, sei, command line without the binary, expected AR SEI) of all
+    runs. The expectation is None for playback, which has no output."""
+    clips = sorted(glob.glob(os.path.join(args.clips, "*.h26[45]")))
+    if not clips:
+        sys.exit("No .h264 or .h265 clips in " + args.clips)
+    for app in args.apps:
+        for clip in clips:
+            codec = os.path.splitext(clip)[1][1:]
+            name = os.path.basename(clip)
+            if app == "playback":
+                if codec in args.codecs:
+                    yield app, name, codec, None, ["-i", clip, "-c", codec, "-n"], None
+                continue
+            for sei in (1, 0):
+                if app == "classification_encode" and codec in args.codecs:
+                    # The regions come from the AR SEI of the input, a clip without has none to write
+                    with open(clip, "rb") as f:
+                        expect_sei = sei == 1 and annotated_regions_nal_units(f.read(), codec == "h265") > 0
+                    yield app, name, codec, sei, ["-i", clip, "-j", codec, "-k", codec], expect_sei
+                elif app == "detect_encode" and codec == "h264":
+                    # Raw input, so every clip once, encoded in both codecs
+                    raw = decode_raw(clip, codec, os.path.join(args.bin_dir, "raw"))
+                    for out_codec in args.codecs:
+                        yield (app, name, out_codec, sei,
+                               ["-i", raw, "-c", out_codec, "--width", str(RAW_WIDTH), "--height", str(RAW_HEIGHT)],
+                               sei == 1)
+
+
+def run_once(command, codec, expect_sei, timeout):
+    """Runs a sample in an empty directory, the encoders write to output/ below it. A run of an
+    encoder fails if its output has AR SEI against expect_sei, None skips the check."""
+    work_dir = tempfile.mkdtemp(prefix="arsei_benchmark_")
+    try:
+        os.mkdir(os.path.join(work_dir, "output"))
+        stats_file = os.path.join(work_dir, "stats.json")
+        log_file = os.path.join(work_dir, "stderr.log")
+        start = time.monotonic()
+        with open(log_file, "w") as log:
+            process = subprocess.Popen(command + ["--stats", stats_file], cwd=work_dir,
+                                       stdout=subprocess.DEVNULL, stderr=log)
+        deadline = start + timeout
+        # wait4 gives the CPU time and peak RSS of exactly this child
+        while True:
+            pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+            if pid:
+                break
+            if time.monotonic() > deadline:
+                process.kill()
+                pid, status, usage = os.wait4(process.pid, 0)
+                break
+            time.sleep(0.05)
+        wall_s = time.monotonic() - start
+        exit_code = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -os.WTERMSIG(status)
+        with open(log_file, errors="replace") as log:
+            stderr = log.read().strip()
+
+        outputs = glob.glob(os.path.join(work_dir, "output", "*"))
+        result = {
+            "exit_code": exit_code,
+            "wall_s": round(wall_s, 3),
+            "cpu_s": round(usage.ru_utime + usage.ru_stime, 3),
+            # ru_maxrss is in kilobytes on Linux
+            "peak_rss_mb": round(usage.ru_maxrss / 1024.0, 1),
+            "output_bytes": sum(os.path.getsize(path) for path in outputs),
+        }
+        if expect_sei is not None:
+            result["sei_nal_units"] = 0
+            for path in outputs:
+                with open(path, "rb") as f:
+                    result["sei_nal_units"] += annotated_regions_nal_units(f.read(), codec == "h265")
+        try:
+            with open(stats_file) as f:
+                stats = json.load(f)
+            result["frames"] = stats["frames"]
+            result["fps"] = stats["fps"]
+            result["latency_p95_ms"] = stats["latency"]["p95_ms"]
+        except (OSError, ValueError, KeyError):
+            result["frames"] = 0
+            result["fps"] = 0.0
+        if exit_code != 0:
+            result["error"] = stderr.splitlines()[-1] if stderr else "exit code %d" % exit_code
+        elif expect_sei is False and result["sei_nal_units"]:
+            result["error"] = "%d AR SEI NAL units in the output" % result["sei_nal_units"]
+        elif expect_sei and not result["sei_nal_units"]:
+            result["error"] = "no AR SEI in the output"
+        return result
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+
+def key(entry):
+    return "%s/%s/%s/sei=%s" % (entry["app"], entry["clip"], entry["codec"],
+                                "-" if entry["sei"] is None else entry["sei"])
+
+
+def run(args):
+    entries = []
+    for app, clip, codec, sei, options, expect_sei in cases(args):
+        command = [binary(args.bin_dir, app, sei)] + options
+        if not os.access(command[0], os.X_OK):
+            sys.exit("%s is not built, run make first" % command[0])
+        entry = {"app": app, "clip": clip, "codec": codec, "sei": sei, "command": " ".join(command), "runs": []}
+        for i in range(args.repeats):
+            result = run_once(command, codec, expect_sei, args.timeout)
+            entry["runs"].append(result)
+            print("%-60s run %d: %7.2f fps %7.2f s CPU %7.1f MB %10d bytes%s" %
+                  (key(entry), i + 1, result["fps"], result["cpu_s"], result["peak_rss_mb"],
+                   result["output_bytes"], "  FAILED: " + result["error"] if "error" in result else ""))
+            sys.stdout.flush()
+        # Medians, so that a single disturbed run doesn't decide
+        ok = [r for r in entry["runs"] if "error" not in r]
+        entry["failed"] = len(entry["runs"]) - len(ok)
+        entry["median"] = {name: statistics.median(r[name] for r in ok) if ok else None
+                           for name in list(METRICS) + ["wall_s", "frames"]}
+        entries.append(entry)
+    return {
+        "created": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "host": platform.node(),
+        "cpu": platform.processor() or platform.machine(),
+        "repeats": args.repeats,
+        "results": entries,
+    }
+
+
+def compare(report, baseline, tolerance):
+    """Prints the changes of the medians against the baseline, returns the number of regressions."""
+    old = {key(entry): entry for entry in baseline["results"]}
+    regressions = 0
+    print("\nAgainst baseline of %s (%s), tolerance %.0f%%" %
+          (baseline.get("created", "?"), baseline.get("host", "?"), tolerance * 100))
+    for entry in report["results"]:
+        name = key(entry)
+        if name not in old:
+            print("%-60s not in baseline" % name)
+            continue
+        if entry["failed"] and not old[name]["failed"]:
+            print("%-60s REGRESSION: %d of %d runs failed" % (name, entry["failed"], len(entry["runs"])))
+            regressions += 1
+            continue
+        for metric, higher_is_better in METRICS.items():
+            now, before = entry["median"][metric], old[name]["median"][metric]
+            if now is None or not before:
+                continue
+            change = (now - before) / float(before)
+            worse = change < -tolerance if higher_is_better else change > tolerance
+            if worse:
+                regressions += 1
+            if worse or abs(change) > tolerance:
+                print("%-60s %-13s %12.2f -> %12.2f (%+.1f%%)%s" %
+                      (name, metric, before, now, change * 100, "  REGRESSION" if worse else ""))
+    print("%d regression%s" % (regressions, "" if regressions == 1 else "s"))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bin-dir", help="build directory of benchmarks/pipelines")
+    parser.add_argument("--clips", help="directory of the .h264 and .h265 clips")
+    parser.add_argument("--apps", default=",".join(APPS), help="samples to run, comma separated")
+    parser.add_argument("--codecs", default=",".join(CODECS), help="codecs to run, comma separated")
+    parser.add_argument("--repeats", type=int, default=3, help="runs of every case (3)")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds before a run is killed (600)")
+    parser.add_argument("--report", default="benchmark_report.json", help="report to write")
+    parser.add_argument("--baseline", help="earlier report to compare against")
+    parser.add_argument("--tolerance", type=float, default=0.05,
+                        help="relative change of a median counted as regression (0.05)")
+    parser.add_argument("--compare", metavar="REPORT", help="compare REPORT against --baseline without running")
+    args = parser.parse_args()
+    args.apps = [app for app in args.apps.split(",") if app]
+    args.codecs = [codec for codec in args.codecs.split(",") if codec]
+    if any(app not in APPS for app in args.apps) or any(codec not in CODECS for codec in args.codecs):
+        parser.error("apps are %s, codecs %s" % (", ".join(APPS), ", ".join(CODECS)))
+
+    if args.compare:
+        if not args.baseline:
+            parser.error("--compare needs --baseline")
+        with open(args.compare) as f:
+            report = json.load(f)
+    else:
+        if not args.bin_dir or not args.clips or args.repeats < 1:
+            parser.error("--bin-dir, --clips and --repeats >= 1 are needed to run")
+        # The samples run in temporary directories
+        args.bin_dir = os.path.abspath(args.bin_dir)
+        args.clips = os.path.abspath(args.clips)
+        report = run(args)
+        with open(args.report, "w") as f:
+            json.dump(report, f, indent=2)
+        print("Report written to " + args.report)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        return 1 if compare(report, baseline, args.tolerance) else 0
+    return 1 if any(entry["failed"] for entry in report["results"]) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,7 +5,8 @@
  * Reused 2 functions from interactive_face_detection_demo
  * See https://github.com/openvinotoolkit/open_model_zoo/blob/2018/demos/interactive_face_detection_demo
  * Changed argument list for HeadPoseDetection::drawAxes
- * Added return value for HeadPoseDetection::buildCameraMatrix
+ * Folded HeadPoseDetection::buildCameraMatrix into the projection
+ * Replaced cv::Mat by fixed size cv::Matx so drawing doesn't allocate
  * Adapted code style to match with Video Analytics GStreamer* plugins project
  * Fixed warnings
  ******************************************************************************/
@@ -14,14 +15,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-cv::Mat buildCameraMatrix(int cx, int cy, float focalLength) {
-    cv::Mat cameraMatrix = cv::Mat::zeros(3, 3, CV_32F);
-    cameraMatrix.at<float>(0) = focalLength;
-    cameraMatrix.at<float>(2) = static_cast<float>(cx);
-    cameraMatrix.at<float>(4) = focalLength;
-    cameraMatrix.at<float>(5) = static_cast<float>(cy);
-    cameraMatrix.at<float>(8) = 1;
-    return cameraMatrix;
+#define FOCAL_LENGTH 950.0f
+
+// Projects a point of the rotated axes, the camera sits FOCAL_LENGTH in front of the face center
+static cv::Point project(const cv::Vec3f &axis, cv::Point3f cpoint) {
+    float z = axis[2] + FOCAL_LENGTH;
+    return cv::Point(static_cast<int>(axis[0] / z * FOCAL_LENGTH + cpoint.x),
+                     static_cast<int>(axis[1] / z * FOCAL_LENGTH + cpoint.y));
 }
 
 void drawAxes(cv::Mat &frame, cv::Point3f cpoint, double yaw, double pitch, double roll, float scale) {
@@ -32,51 +32,19 @@ void drawAxes(cv::Mat &frame, cv::Point3f cpoint, double yaw, double pitch, doub
     cv::Matx33f Rx(1, 0, 0, 0, cos(pitch), -sin(pitch), 0, sin(pitch), cos(pitch));
     cv::Matx33f Ry(cos(yaw), 0, -sin(yaw), 0, 1, 0, sin(yaw), 0, cos(yaw));
     cv::Matx33f Rz(cos(roll), -sin(roll), 0, sin(roll), cos(roll), 0, 0, 0, 1);
+    cv::Matx33f r = Rz * Ry * Rx;
 
-    auto r = cv::Mat(Rz * Ry * Rx);
-    cv::Mat cameraMatrix = buildCameraMatrix(frame.cols / 2, frame.rows / 2, 950.0);
-
-    cv::Mat xAxis(3, 1, CV_32F), yAxis(3, 1, CV_32F), zAxis(3, 1, CV_32F), zAxis1(3, 1, CV_32F);
-
-    xAxis.at<float>(0) = 1 * scale;
-    xAxis.at<float>(1) = 0;
-    xAxis.at<float>(2) = 0;
-
-    yAxis.at<float>(0) = 0;
-    yAxis.at<float>(1) = -1 * scale;
-    yAxis.at<float>(2) = 0;
-
-    zAxis.at<float>(0) = 0;
-    zAxis.at<float>(1) = 0;
-    zAxis.at<float>(2) = -1 * scale;
-
-    zAxis1.at<float>(0) = 0;
-    zAxis1.at<float>(1) = 0;
-    zAxis1.at<float>(2) = 1 * scale;
-
-    cv::Mat o(3, 1, CV_32F, cv::Scalar(0));
-    o.at<float>(2) = cameraMatrix.at<float>(0);
-
-    xAxis = r * xAxis + o;
-    yAxis = r * yAxis + o;
-    zAxis = r * zAxis + o;
-    zAxis1 = r * zAxis1 + o;
-
-    cv::Point p1, p2;
-
-    p2.x = static_cast<int>((xAxis.at<float>(0) / xAxis.at<float>(2) * cameraMatrix.at<float>(0)) + cpoint.x);
-    p2.y = static_cast<int>((xAxis.at<float>(1) / xAxis.at<float>(2) * cameraMatrix.at<float>(4)) + cpoint.y);
-    cv::line(frame, cv::Point(cpoint.x, cpoint.y), p2, cv::Scalar(0, 0, 255), 2);
-
-    p2.x = static_cast<int>((yAxis.at<float>(0) / yAxis.at<float>(2) * cameraMatrix.at<float>(0)) + cpoint.x);
-    p2.y = static_cast<int>((yAxis.at<float>(1) / yAxis.at<float>(2) * cameraMatrix.at<float>(4)) + cpoint.y);
-    cv::line(frame, cv::Point(cpoint.x, cpoint.y), p2, cv::Scalar(0, 255, 0), 2);
+    cv::Vec3f xAxis = r * cv::Vec3f(scale, 0, 0);
+    cv::Vec3f yAxis = r * cv::Vec3f(0, -scale, 0);
+    cv::Vec3f zAxis = r * cv::Vec3f(0, 0, -scale);
+    cv::Vec3f zAxis1 = -zAxis;
 
-    p1.x = static_cast<int>((zAxis1.at<float>(0) / zAxis1.at<float>(2) * cameraMatrix.at<float>(0)) + cpoint.x);
-    p1.y = static_cast<int>((zAxis1.at<float>(1) / zAxis1.at<float>(2) * cameraMatrix.at<float>(4)) + cpoint.y);
+    cv::Point center(cpoint.x, cpoint.y);
+    cv::line(frame, center, project(xAxis, cpoint), cv::Scalar(0, 0, 255), 2);
+    cv::line(frame, center, project(yAxis, cpoint), cv::Scalar(0, 255, 0), 2);
 
-    p2.x = static_cast<int>((zAxis.at<float>(0) / zAxis.at<float>(2) * cameraMatrix.at<float>(0)) + cpoint.x);
-    p2.y = static_cast<int>((zAxis.at<float>(1) / zAxis.at<float>(2) * cameraMatrix.at<float>(4)) + cpoint.y);
-    cv::line(frame, p1, p2, cv::Scalar(255, 0, 0), 2);
-    cv::circle(frame, p2, 3, cv::Scalar(255, 0, 0), 2);
+    cv::Point p2 = project(zAxis, cpoint);
+    cv::line(frame, project(zAxis1, cpoint), p2, cv::Scalar(255, 0, 0), 2);
+    // A thick outline would go through cv::ellipse2Poly and a vector, the filled 8-connected circle doesn't
+    cv::circle(frame, p2, 4, cv::Scalar(255, 0, 0), cv::FILLED);
 }
@@ -0,0 +1,52 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "glyph_atlas.h"
+
+#include <algorithm>
+
+GlyphAtlas::GlyphAtlas(int font_face, double font_scale, int thickness) {
+    int width = 0, descent = 0;
+    for (char c = ' '; c <= '~'; c++) {
+        int baseline = 0;
+        cv::Size size = cv::getTextSize(std::string(1, c), font_face, font_scale, thickness, &baseline);
+        glyphs[c - ' '] = {width, size.width};
+        width += size.width;
+        ascent = std::max(ascent, size.height);
+        descent = std::max(descent, baseline);
+    }
+    // The strokes reach up to half the thickness beyond the text box
+    ascent += thickness;
+    atlas = cv::Mat::zeros(ascent + descent + thickness, width, CV_8UC1);
+    for (char c = ' '; c <= '~'; c++)
+        cv::putText(atlas, std::string(1, c), cv::Point(glyphs[c - ' '].x, ascent), font_face, font_scale,
+                    cv::Scalar(255), thickness, cv::LINE_AA);
+}
+
+void GlyphAtlas::Draw(cv::Mat &frame, const char *text, cv::Point origin, const cv::Scalar &color) const {
+    const int channels = frame.channels();
+    const int b = (int)color[0], g = (int)color[1], r = (int)color[2];
+    int top = origin.y - ascent;
+    int y0 = std::max(top, 0), y1 = std::min(top + atlas.rows, frame.rows);
+    for (int pen = origin.x; *text && pen < frame.cols; text++) {
+        char c = *text >= ' ' && *text <= '~' ? *text : '?';
+        const Glyph &glyph = glyphs[c - ' '];
+        int x0 = std::max(pen, 0), x1 = std::min(pen + glyph.width, frame.cols);
+        for (int y = y0; y < y1; y++) {
+            const uchar *coverage = atlas.ptr<uchar>(y - top) + glyph.x - pen;
+            uchar *pixel = frame.ptr<uchar>(y) + x0 * channels;
+            for (int x = x0; x < x1; x++, pixel += channels) {
+                int a = coverage[x];
+                if (a == 0)
+                    continue;
+                pixel[0] = (uchar)((b * a + pixel[0] * (255 - a) + 127) / 255);
+                pixel[1] = (uchar)((g * a + pixel[1] * (255 - a) + 127) / 255);
+                pixel[2] = (uchar)((r * a + pixel[2] * (255 - a) + 127) / 255);
+            }
+        }
+        pen += glyph.width;
+    }
+}
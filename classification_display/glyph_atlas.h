@@ -0,0 +1,33 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// Printable ASCII characters rendered once with cv::putText, so labels are drawn by copying
+// glyphs instead of rasterizing the Hershey strokes of every character on every frame.
+// Drawing doesn't allocate.
+class GlyphAtlas {
+  public:
+    GlyphAtlas(int font_face, double font_scale, int thickness);
+
+    // Draws text into a BGRx or BGRA frame with the bottom left corner of the text at origin,
+    // like cv::putText. Characters outside printable ASCII are drawn as '?'.
+    void Draw(cv::Mat &frame, const char *text, cv::Point origin, const cv::Scalar &color) const;
+
+  private:
+    struct Glyph {
+        int x;
+        int width;
+    };
+
+    // Anti-aliased coverage of all glyphs side by side
+    cv::Mat atlas;
+    // Distance from the top of the atlas to the baseline
+    int ascent = 0;
+    Glyph glyphs['~' - ' ' + 1];
+};
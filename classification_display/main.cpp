@@ -8,12 +8,24 @@
 #include <dirent.h>
 #include <gio/gio.h>
 #include <gst/gst.h>
+#include <memory>
 #include <opencv2/opencv.hpp>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "classification_cache.h"
+#include "classifier_branches.h"
 #include "draw_axes.h"
+#include "face_attributes.h"
+#include "glyph_atlas.h"
 #include "gst/videoanalytics/video_frame.h"
+#include "model_index.h"
+#include "pipeline_stats.h"
+
+#define MAX_OBJECTS 50
+// Room for the detection label and the attributes of every model
+#define MAX_LABEL_LENGTH 128
 
 using namespace std;
 
@@ -21,66 +33,6 @@ gchar const *icomp_scheme = NULL;
 
 #define UNUSED(x) (void)(x)
 
-std::vector<std::string> SplitString(const std::string input, char delimiter = ':') {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(input);
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
-    }
-    return tokens;
-}
-
-void ExploreDir(std::string search_dir, const std::string &model_name, std::vector<std::string> &result) {
-    if (auto dir_handle = opendir(search_dir.c_str())) {
-        while (auto file_handle = readdir(dir_handle)) {
-            if ((!file_handle->d_name) || (file_handle->d_name[0] == '.'))
-                continue;
-            if (file_handle->d_type == DT_DIR)
-                ExploreDir(search_dir + file_handle->d_name + "/", model_name, result);
-            if (file_handle->d_type == DT_REG) {
-                std::string name(file_handle->d_name);
-                if (name == model_name)
-                    result.push_back(search_dir + "/" + name);
-            }
-        }
-        closedir(dir_handle);
-    }
-}
-
-std::vector<std::string> FindModel(const std::vector<std::string> &search_dirs, const std::string &model_name) {
-    std::vector<std::string> result = {};
-    for (std::string dir : search_dirs) {
-        ExploreDir(dir + "/", model_name, result);
-    }
-    return result;
-}
-
-std::string to_upper_case(std::string str) {
-    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
-    return str;
-}
-
-std::map<std::string, std::string> FindModels(const std::vector<std::string> &search_dirs,
-                                              const std::vector<std::string> &model_names,
-                                              const std::string &precision) {
-    std::map<std::string, std::string> result;
-    for (std::string model_name : model_names) {
-        std::vector<std::string> model_paths = FindModel(search_dirs, model_name);
-        if (model_paths.empty())
-            throw std::runtime_error("Can't find file for model: " + model_name);
-        result[model_name] = model_paths.front();
-        // The path to the model must contain the precision (/FP32/ or /INT8/)
-        for (auto &model_path : model_paths)
-            // TODO extract precision from xml file
-            if (to_upper_case(model_path).find(to_upper_case(precision)) != std::string::npos) {
-                result[model_name] = model_path;
-                break;
-            }
-    }
-    return result;
-}
-
 const std::string env_models_path =
     std::string() + (getenv("MODELS_PATH") != NULL
                          ? getenv("MODELS_PATH")
@@ -109,6 +61,11 @@ gchar const *model_precision = "FP32";
 gint batch_size = 1;
 gdouble threshold = 0.3;
 gboolean no_display = FALSE;
+gint reclassify_interval = 0;
+gdouble reclassify_size = 0.3;
+gboolean serial_classifiers = FALSE;
+gchar const *stats_file = NULL;
+gint stats_interval = 0;
 // This structure will be used to pass user data (such as memory type) to the
 // callback function.
 static GOptionEntry opt_entries[] = {
@@ -123,13 +80,73 @@ static GOptionEntry opt_entries[] = {
     {"batch", 'b', 0, G_OPTION_ARG_INT, &batch_size, "Batch size", NULL},
     {"threshold", 't', 0, G_OPTION_ARG_DOUBLE, &threshold, "Confidence threshold for detection (0 - 1)", NULL},
     {"no-display", 'n', 0, G_OPTION_ARG_NONE, &no_display, "Run without display", NULL},
+    {"reclassify-interval", 0, 0, G_OPTION_ARG_INT, &reclassify_interval,
+     "Classify a tracked object only every N frames and reuse the result in between, 0 classifies every frame. "
+     "Default: 0",
+     NULL},
+    {"reclassify-size", 0, 0, G_OPTION_ARG_DOUBLE, &reclassify_size,
+     "Classify a tracked object again when its box width or height changed by more than this fraction. Default: 0.3",
+     NULL},
+    {"serial-classifiers", 0, 0, G_OPTION_ARG_NONE, &serial_classifiers,
+     "Run the classification models one after another instead of on parallel branches", NULL},
+    {"stats", 0, 0, G_OPTION_ARG_STRING, &stats_file,
+     "Write per-element latencies, queue levels, frame latency and fps as JSON to this file ('-' for stdout)",
+     NULL},
+    {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval,
+     "Rewrite the --stats file every that many seconds while running (0: at the end only)", NULL},
     GOptionEntry()};
 
+// Puts back the regions that skipped classification, before gvawatermark draws the boxes
+static GstPadProbeReturn restore_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ClassificationCache *cache = static_cast<ClassificationCache *>(user_data);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer == NULL)
+        return GST_PAD_PROBE_OK;
+    std::vector<DeferredRegion> regions = cache->TakeDeferred(GST_BUFFER_PTS(buffer));
+    if (regions.empty())
+        return GST_PAD_PROBE_OK;
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+        throw std::runtime_error("Can't get current caps");
+    GVA::VideoFrame video_frame(buffer, caps);
+    for (DeferredRegion &region : regions) {
+        auto new_roi = video_frame.add_region(region.x, region.y, region.w, region.h, region.label.c_str(),
+                                              region.confidence);
+        if (region.params)
+            gst_video_region_of_interest_meta_add_param(new_roi._meta(), region.params);
+    }
+    gst_caps_unref(caps);
+
+    return GST_PAD_PROBE_OK;
+}
+
+// Outputs of the classification models in the pipeline, set up before it starts
+static FacePostProcessor face_post_processing;
+
+// Glyphs of the label font, rendered on the first frame
+static const GlyphAtlas &label_glyphs() {
+    static const GlyphAtlas glyphs(cv::FONT_HERSHEY_SIMPLEX, 1, 2);
+    return glyphs;
+}
+
+// Appends formatted text to a label as far as it fits
+static void append_label(char *label, size_t &length, const char *format, ...) {
+    if (length + 1 >= MAX_LABEL_LENGTH)
+        return;
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(label + length, MAX_LABEL_LENGTH - length, format, args);
+    va_end(args);
+    if (written > 0)
+        length = std::min(length + written, (size_t)MAX_LABEL_LENGTH - 1);
+}
+
 // This structure will be used to pass user data (such as memory type) to the callback function.
 // Printing classification results on a frame
 // Gets called to notify about the current blocking type
 static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    UNUSED(user_data);
+    ClassificationCache *cache = static_cast<ClassificationCache *>(user_data);
 
     // Create buffer with data from GstPadProbeInfo
     auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
@@ -159,65 +176,41 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
         return GST_PAD_PROBE_OK;
     cv::Mat mat(height, width, CV_8UC4, map.data);
     
-    GstVideoRegionOfInterestMeta* rmeta;
-    GstStructure *s;
-    gint object_id;
-    guint k = 0;
-
-    // Iterate detected objects and all attributes (tensors)
-    for (GVA::RegionOfInterest &roi : video_frame.regions()) {
-        // Get GstVideoRegionOfInterestMeta from region
-        
-        // Get GstVideoRegionOfInterestMeta from region
-        string label;
-        float head_angle_r = 0, head_angle_p = 0, head_angle_y = 0;
-        auto rect = roi.rect();
-        
-        //std::cout<<roi.object_id()<<"\t"<<rect.x<<"\t"<<rect.y<<"\t"<<rect.w<<"\t"<<rect.h<<std::endl;
-        
+    // Labels are put together in place, the overlay draws without allocating
+    const GlyphAtlas &glyphs = label_glyphs();
+    char label[MAX_LABEL_LENGTH];
+    FaceAttributes attributes;
+
+    // Iterate detected objects and all attributes (tensors), the tensors are read in place
+    gpointer state = NULL;
+    GstMeta *meta;
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+        auto roi = reinterpret_cast<GstVideoRegionOfInterestMeta *>(meta);
         //Existing label in the stream
-        label += roi.label();
-        label += "_";
+        size_t label_length = 0;
+        append_label(label, label_length, "%s_", g_quark_to_string(roi->roi_type));
  
-        for (auto tensor : roi.tensors()) {
-            string model_name = tensor.model_name();
-            string layer_name = tensor.layer_name();
-            vector<float> data = tensor.data<float>();
-
-            if (layer_name == "prob") {
-                label += (data[1] > 0.5) ? "_M" : "_F";
-            }
-            if (layer_name == "age_conv3") {
-                label += to_string((int)(data[0] * 100));
-            }
-            if (layer_name == "prob_emotion") {
-                static const vector<string> emotionsDesc = {"neutral", "happy", "sad", "surprise", "anger"};
-                int index = max_element(begin(data), end(data)) - begin(data);
-                label += " " + emotionsDesc[index];
-            }
-            // Get info for drawing axes
-            if (layer_name.find("angle_r") != string::npos) {
-                head_angle_r = data[0];
-            }
-            if (layer_name.find("angle_p") != string::npos) {
-                head_angle_p = data[0];
-            }
-            if (layer_name.find("angle_y") != string::npos) {
-                head_angle_y = data[0];
-            }
-          }
-            
-        		// Write attributes
-        		if (!label.empty()) {
-            		auto pos = cv::Point2f(rect.x, rect.y + rect.h + 30);
-            		cv::putText(mat, label, pos, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
-        		}
-        		// Draw axes
-        		if (head_angle_r != 0 && head_angle_p != 0 && head_angle_y != 0) {
-            		cv::Point3f center(rect.x + rect.w / 2, rect.y + rect.h / 2, 0);
-            		drawAxes(mat, center, head_angle_r, head_angle_p, head_angle_y, 50);            
+        size_t tensors = face_post_processing.Process(roi, attributes);
+        // Objects that skipped classification get the attributes of their last classification
+        gint obj_id = -1;
+        GstStructure *arsei = gst_video_region_of_interest_meta_get_param(roi, "roi/arsei");
+        if (arsei)
+            gst_structure_get_int(arsei, "obj_id", &obj_id);
+        if (obj_id >= 0) {
+            if (tensors > 0)
+                cache->Store(obj_id, attributes.text);
+            else
+                attributes.length = cache->Lookup(obj_id, attributes.text, sizeof(attributes.text));
+        }
+        append_label(label, label_length, "%s", attributes.text);
+
+        // Write attributes
+        glyphs.Draw(mat, label, cv::Point(roi->x, roi->y + roi->h + 30), cv::Scalar(0, 0, 255));
+        // Draw axes
+        if (attributes.head_angle_r != 0 && attributes.head_angle_p != 0 && attributes.head_angle_y != 0) {
+            cv::Point3f center(roi->x + roi->w / 2, roi->y + roi->h / 2, 0);
+            drawAxes(mat, center, attributes.head_angle_y, attributes.head_angle_p, attributes.head_angle_r, 50);
         }
-        
     }
 
     // Release the memory previously mapped with gst_buffer_map
@@ -232,7 +225,7 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
 #if 1 //DLStreamer-Style callback
 // Debug probe callback
 static GstPadProbeReturn debug_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    UNUSED(user_data);
+    ClassificationCache *cache = static_cast<ClassificationCache *>(user_data);
 
     // Create buffer with data from GstPadProbeInfo
     auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
@@ -267,28 +260,50 @@ static GstPadProbeReturn debug_probe_callback(GstPad *pad, GstPadProbeInfo *info
     int Width[MAX_OBJECTS];
     int Height[MAX_OBJECTS];
     std::string Label[MAX_OBJECTS];
+    double Confidence[MAX_OBJECTS];
+    GstStructure *Params[MAX_OBJECTS];
     int i = 0;
 
     // Iterate detected objects and all attributes (tensors)
     //Palanivel: Hack to make the pipeline to work
     for (GVA::RegionOfInterest &roi : video_frame.regions()) {
+        if (i == MAX_OBJECTS)
+            break;
    
         // Get GstVideoRegionOfInterestMeta from region
         auto rect = roi.rect();
+        // AR SEI parameters decoded by the parser (object index, confidence)
+        GstStructure *param = gst_video_region_of_interest_meta_get_param(roi._meta(), "roi/arsei");
         Left[i] = rect.x;
         Top[i] = rect.y;
         Width[i] = rect.w;
         Height[i] = rect.h;
+        Confidence[i] = 0.0;
+        if (param)
+            gst_structure_get_double(param, "confidence", &Confidence[i]);
+        Params[i] = param ? gst_structure_copy(param) : NULL;
         Label[i++] = roi.label();
         //Remove the ROIs from the buffer
         video_frame.remove_region(roi);
     }
     
     //Add the ROIs using add_region() call
+    //Objects in the classification cache skip the inference, the watermark probe puts them back
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
     for (int j = 0; j < i; j++)
     {
-        video_frame.add_region (Left[j], Top[j], Width[j], Height[j], Label[j].c_str());
+        gint obj_id = -1;
+        if (Params[j])
+            gst_structure_get_int(Params[j], "obj_id", &obj_id);
+        if (GST_CLOCK_TIME_IS_VALID(pts) && !cache->NeedsClassification(obj_id, Width[j], Height[j])) {
+            cache->Defer(pts, {Left[j], Top[j], Width[j], Height[j], Label[j], Confidence[j], Params[j], obj_id});
+            continue;
+        }
+        auto new_roi = video_frame.add_region (Left[j], Top[j], Width[j], Height[j], Label[j].c_str(), Confidence[j]);
+        if (Params[j])
+            gst_video_region_of_interest_meta_add_param (new_roi._meta(), Params[j]);
     }
+    cache->EndFrame();
 
     // Release the memory previously mapped with gst_buffer_map
     gst_buffer_unmap(buffer, &map);
@@ -402,7 +417,7 @@ int main(int argc, char *argv[]) {
         throw std::runtime_error("Enviroment variable MODELS_PATH is not set");
     }
     std::map<std::string, std::string> model_paths;
-    std::string classify_str = "";
+    std::vector<std::string> classifiers;
     if (detection_model == NULL) {
         for (const auto &model_to_path :
              FindModels(SplitString(env_models_path), default_detection_model_names, model_precision))
@@ -411,9 +426,12 @@ int main(int argc, char *argv[]) {
     }
     if (classification_models == NULL) {
         for (const auto &model_to_path :
-             FindModels(SplitString(env_models_path), default_classification_model_names, model_precision))
-            classify_str += "gvainference model=" + model_to_path.second + " device=" + device +
-                            " batch-size=" + std::to_string(batch_size) + " inference-region=roi-list ! queue ";
+             FindModels(SplitString(env_models_path), default_classification_model_names, model_precision)) {
+            if (!face_post_processing.AddModel(model_to_path.first))
+                g_print("No post-processing for %s, its results are not shown\n", model_to_path.first.c_str());
+            classifiers.push_back("gvainference model=" + model_to_path.second + " device=" + device +
+                                  " batch-size=" + std::to_string(batch_size) + " inference-region=roi-list");
+        }
     }
 
 		if (h264_icompression_scheme == TRUE) {
@@ -425,28 +443,43 @@ int main(int argc, char *argv[]) {
     
     gchar const *sink = "fpsdisplaysink video-sink=autovideosink sync=false";
     
+    // Every classifier on its own branch, unless asked for the serial chain
+    std::string branches;
+    std::string classify_str = ClassifierChain(classifiers, !serial_classifiers, branches);
     auto launch_str = g_strdup_printf("%s=%s ! %s ! capsfilter caps=\"%s\" !"
-                                      "%s ! gvawatermark name=gvawatermark ! videoconvert n-threads=4 ! %s ",
-                                      video_source, input_file, preprocess_pipeline, capfilter, classify_str.c_str(), sink);
+                                      "%s ! gvawatermark name=gvawatermark ! videoconvert n-threads=4 ! %s %s",
+                                      video_source, input_file, preprocess_pipeline, capfilter, classify_str.c_str(), sink,
+                                      branches.c_str());
 
     g_print("PIPELINE: %s \n", launch_str);
+    ClassificationCache cache(reclassify_interval, reclassify_size);
+    BranchMerger merger;
     GstElement *pipeline = gst_parse_launch(launch_str, NULL);
     g_free(launch_str);
+    merger.Attach(pipeline);
+    std::unique_ptr<PipelineStats> pipeline_stats;
+    if (stats_file) {
+        pipeline_stats.reset(new PipelineStats(stats_file, stats_interval));
+        pipeline_stats->Attach(pipeline);
+    }
 
 		// set probe callback
 		auto gvawatermark = gst_bin_get_by_name(GST_BIN(pipeline), "gvawatermark");
 		auto pad = gst_element_get_static_pad(gvawatermark, "src");
 		// The provided callback 'pad_probe_callback' is called for every state that
 		// matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, NULL, NULL);
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, &cache, NULL);
 		gst_object_unref(pad);
+		auto wpad = gst_element_get_static_pad(gvawatermark, "sink");
+		gst_pad_add_probe(wpad, GST_PAD_PROBE_TYPE_BUFFER, restore_probe_callback, &cache, NULL);
+		gst_object_unref(wpad);
 		
 		//debug callback
 		auto dbug = gst_bin_get_by_name(GST_BIN(pipeline), "vconv");
 		auto dpad = gst_element_get_static_pad(dbug, "sink");
 		// The provided callback 'pad_probe_callback' is called for every state that
 		// matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-		gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, debug_probe_callback, NULL, NULL);
+		gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, debug_probe_callback, &cache, NULL);
 		gst_object_unref(dpad);		
     
     // Start playing
@@ -475,6 +508,12 @@ int main(int argc, char *argv[]) {
     if (msg)
         gst_message_unref(msg);
 
+    if (cache.enabled())
+        g_print("Classified %" G_GUINT64_FORMAT " faces, %" G_GUINT64_FORMAT " taken from the cache\n",
+                (guint64)cache.classified(), (guint64)cache.cached());
+    if (pipeline_stats && !pipeline_stats->Write())
+        g_printerr("Can't write statistics to %s\n", stats_file);
+
     // Free resources
     gst_object_unref(bus);
     gst_element_set_state(pipeline, GST_STATE_NULL);
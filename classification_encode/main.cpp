@@ -7,20 +7,41 @@
 #include <algorithm>
 #include <dirent.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <gst/gst.h>
+#include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "classification_cache.h"
+#include "classifier_branches.h"
 #include "draw_axes.h"
+#include "es_segmenter.h"
+#include "face_attributes.h"
 #include "gst/videoanalytics/video_frame.h"
+#include "job_server.h"
+#include "metrics_server.h"
+#include "model_index.h"
+#include "pipeline_stats.h"
+#include "stage_timer.h"
 
 #define MAX_OBJECTS 50
 
-#define ENABLE_ARSEI_INSERTION 0
+// Overridden with -DENABLE_ARSEI_INSERTION=0|1 by the pipeline benchmarks
+#ifndef ENABLE_ARSEI_INSERTION
+  #define ENABLE_ARSEI_INSERTION 0
+#endif
 
 #if ENABLE_ARSEI_INSERTION
   #define ARSEI_INSERT_LABEL 0
+  // The AR SEI parameters decoded from the input go back on the regions and into the output
+  #define OBJECT_PARAM "roi/arsei"
+#else
+  // The encoder writes an AR SEI object for every region with "roi/arsei", so without AR SEI
+  // insertion only the object index is kept, for the classification cache
+  #define OBJECT_PARAM "classify/object"
 #endif
 
 using namespace std;
@@ -30,66 +51,6 @@ gchar const *ocomp_scheme = NULL;
 
 #define UNUSED(x) (void)(x)
 
-std::vector<std::string> SplitString(const std::string input, char delimiter = ':') {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(input);
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
-    }
-    return tokens;
-}
-
-void ExploreDir(std::string search_dir, const std::string &model_name, std::vector<std::string> &result) {
-    if (auto dir_handle = opendir(search_dir.c_str())) {
-        while (auto file_handle = readdir(dir_handle)) {
-            if ((!file_handle->d_name) || (file_handle->d_name[0] == '.'))
-                continue;
-            if (file_handle->d_type == DT_DIR)
-                ExploreDir(search_dir + file_handle->d_name + "/", model_name, result);
-            if (file_handle->d_type == DT_REG) {
-                std::string name(file_handle->d_name);
-                if (name == model_name)
-                    result.push_back(search_dir + "/" + name);
-            }
-        }
-        closedir(dir_handle);
-    }
-}
-
-std::vector<std::string> FindModel(const std::vector<std::string> &search_dirs, const std::string &model_name) {
-    std::vector<std::string> result = {};
-    for (std::string dir : search_dirs) {
-        ExploreDir(dir + "/", model_name, result);
-    }
-    return result;
-}
-
-std::string to_upper_case(std::string str) {
-    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
-    return str;
-}
-
-std::map<std::string, std::string> FindModels(const std::vector<std::string> &search_dirs,
-                                              const std::vector<std::string> &model_names,
-                                              const std::string &precision) {
-    std::map<std::string, std::string> result;
-    for (std::string model_name : model_names) {
-        std::vector<std::string> model_paths = FindModel(search_dirs, model_name);
-        if (model_paths.empty())
-            throw std::runtime_error("Can't find file for model: " + model_name);
-        result[model_name] = model_paths.front();
-        // The path to the model must contain the precision (/FP32/ or /INT8/)
-        for (auto &model_path : model_paths)
-            // TODO extract precision from xml file
-            if (to_upper_case(model_path).find(to_upper_case(precision)) != std::string::npos) {
-                result[model_name] = model_path;
-                break;
-            }
-    }
-    return result;
-}
-
 const std::string env_models_path =
     std::string() + (getenv("MODELS_PATH") != NULL
                          ? getenv("MODELS_PATH")
@@ -112,10 +73,30 @@ gchar const *model_precision = "FP32";
 gint batch_size = 1;
 gdouble threshold = 0.3;
 gboolean no_display = FALSE;
+gint conf_bits = 0;
+gchar const *server_socket = NULL;
+gchar const *spool_dir = NULL;
+gint workers = 1;
+gint segments = 0;
+gint reclassify_interval = 0;
+gchar const *stats_file = NULL;
+gint stats_interval = 0;
+// Latencies of all pipelines, with --stats
+PipelineStats *pipeline_stats = NULL;
+gchar const *metrics_address = NULL;
+// Live counters of all pipelines, with --metrics
+MetricsServer *metrics_server = NULL;
+gdouble reclassify_size = 0.3;
+gboolean bgra = FALSE;
+gboolean stage_timings = FALSE;
+gboolean serial_classifiers = FALSE;
+// One gvainference element per classification model
+std::vector<std::string> classifiers;
 // This structure will be used to pass user data (such as memory type) to the
 // callback function.
 static GOptionEntry opt_entries[] = {
-    {"input", 'i', 0, G_OPTION_ARG_STRING, &input_file, "Path to input video file", NULL},
+    {"input", 'i', 0, G_OPTION_ARG_STRING, &input_file,
+     "Path to input video file, or a ',' separated list of files and glob patterns", NULL},
     {"incomp", 'j', 0, G_OPTION_ARG_STRING, &icomp_scheme, "Compression scheme of input file", NULL},
     {"outcomp", 'k', 0, G_OPTION_ARG_STRING, &ocomp_scheme, "Compression scheme of output file", NULL},    
     {"precision", 'p', 0, G_OPTION_ARG_STRING, &model_precision, "Models precision. Default: FP32", NULL},
@@ -127,11 +108,46 @@ static GOptionEntry opt_entries[] = {
     {"batch", 'b', 0, G_OPTION_ARG_INT, &batch_size, "Batch size", NULL},
     {"threshold", 't', 0, G_OPTION_ARG_DOUBLE, &threshold, "Confidence threshold for detection (0 - 1)", NULL},
     {"no-display", 'n', 0, G_OPTION_ARG_NONE, &no_display, "Run without display", NULL},
+    {"conf-bits", 0, 0, G_OPTION_ARG_INT, &conf_bits,
+     "Bits for the AR SEI object confidence (1 - 16), 0 keeps the precision of the input. Default: 0", NULL},
+    {"server", 0, 0, G_OPTION_ARG_STRING, &server_socket,
+     "Keep the pipelines loaded and take jobs from this UNIX socket", NULL},
+    {"spool", 0, 0, G_OPTION_ARG_STRING, &spool_dir, "Keep the pipelines loaded and take jobs from *.job files in this directory",
+     NULL},
+    {"workers", 'w', 0, G_OPTION_ARG_INT, &workers,
+     "Pipelines running in parallel when several inputs are given, 0 for one per core. Default: 1", NULL},
+    {"segments", 0, 0, G_OPTION_ARG_INT, &segments,
+     "Split the input elementary stream at IDRs into this many segments and process them on the workers", NULL},
+    {"reclassify-interval", 0, 0, G_OPTION_ARG_INT, &reclassify_interval,
+     "Classify a tracked object only every N frames and reuse the result in between, 0 classifies every frame. "
+     "Default: 0",
+     NULL},
+    {"reclassify-size", 0, 0, G_OPTION_ARG_DOUBLE, &reclassify_size,
+     "Classify a tracked object again when its box width or height changed by more than this fraction. Default: 0.3",
+     NULL},
+    {"bgra", 0, 0, G_OPTION_ARG_NONE, &bgra,
+     "Convert the decoded frames to BGRA for inference and back for the encoder instead of passing NV12 through",
+     NULL},
+    {"stage-timings", 0, 0, G_OPTION_ARG_NONE, &stage_timings,
+     "Print the time the frames spend in the decoder, conversion, inference and encoder elements", NULL},
+    {"serial-classifiers", 0, 0, G_OPTION_ARG_NONE, &serial_classifiers,
+     "Run the classification models one after another instead of on parallel branches", NULL},
+    {"stats", 0, 0, G_OPTION_ARG_STRING, &stats_file,
+     "Write per-element latencies, queue levels, frame latency and fps as JSON to this file ('-' for stdout)",
+     NULL},
+    {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval,
+     "Rewrite the --stats file every that many seconds while running (0: at the end only)", NULL},
+    {"metrics", 0, 0, G_OPTION_ARG_STRING, &metrics_address,
+     "Serve Prometheus metrics over HTTP on [host:]port (host defaults to 127.0.0.1) or on a UNIX socket path",
+     NULL},
     GOptionEntry()};
 
+// Outputs of the classification models in the pipeline, set up before it starts
+static FacePostProcessor face_post_processing;
+
 
 static GstPadProbeReturn debug_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    UNUSED(user_data);
+    ClassificationCache *cache = static_cast<ClassificationCache *>(user_data);
 
     // Create buffer with data from GstPadProbeInfo
     auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
@@ -166,28 +182,57 @@ static GstPadProbeReturn debug_probe_callback(GstPad *pad, GstPadProbeInfo *info
     int Width[MAX_OBJECTS];
     int Height[MAX_OBJECTS];
     std::string Label[MAX_OBJECTS];
+    double Confidence[MAX_OBJECTS];
+    GstStructure *Params[MAX_OBJECTS];
     int i = 0;
 
     // Iterate detected objects and all attributes (tensors)
     //Palanivel: Hack to make the pipeline to work
     for (GVA::RegionOfInterest &roi : video_frame.regions()) {
+        if (i == MAX_OBJECTS)
+            break;
    
         // Get GstVideoRegionOfInterestMeta from region
         auto rect = roi.rect();
+        // AR SEI parameters decoded by the parser (object index, confidence)
+        GstStructure *param = gst_video_region_of_interest_meta_get_param(roi._meta(), "roi/arsei");
         Left[i] = rect.x;
         Top[i] = rect.y;
         Width[i] = rect.w;
         Height[i] = rect.h;
+        Confidence[i] = 0.0;
+        if (param)
+            gst_structure_get_double(param, "confidence", &Confidence[i]);
+#if ENABLE_ARSEI_INSERTION
+        Params[i] = param ? gst_structure_copy(param) : NULL;
+#else
+        gint obj_id;
+        Params[i] = param && gst_structure_get_int(param, "obj_id", &obj_id)
+                        ? gst_structure_new(OBJECT_PARAM, "obj_id", G_TYPE_INT, obj_id, NULL)
+                        : NULL;
+#endif
         Label[i++] = roi.label();
         //Remove the ROIs from the buffer
         video_frame.remove_region(roi);
     }
     
     //Add the ROIs using add_region() call
+    //Objects in the classification cache skip the inference, the encoder probe puts them back
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
     for (int j = 0; j < i; j++)
     {
-        video_frame.add_region (Left[j], Top[j], Width[j], Height[j], Label[j].c_str());
+        gint obj_id = -1;
+        if (Params[j])
+            gst_structure_get_int(Params[j], "obj_id", &obj_id);
+        if (GST_CLOCK_TIME_IS_VALID(pts) && !cache->NeedsClassification(obj_id, Width[j], Height[j])) {
+            cache->Defer(pts, {Left[j], Top[j], Width[j], Height[j], Label[j], Confidence[j], Params[j], obj_id});
+            continue;
+        }
+        auto new_roi = video_frame.add_region (Left[j], Top[j], Width[j], Height[j], Label[j].c_str(), Confidence[j]);
+        if (Params[j])
+            gst_video_region_of_interest_meta_add_param (new_roi._meta(), Params[j]);
     }
+    cache->EndFrame();
 
     // Release the memory previously mapped with gst_buffer_map
     gst_buffer_unmap(buffer, &map);
@@ -202,7 +247,7 @@ static GstPadProbeReturn debug_probe_callback(GstPad *pad, GstPadProbeInfo *info
 // Printing classification results on a frame
 // Gets called to notify about the current blocking type
 static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    UNUSED(user_data);
+    ClassificationCache *cache = static_cast<ClassificationCache *>(user_data);
 
     // Create buffer with data from GstPadProbeInfo
     auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
@@ -226,17 +271,19 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
     gint width = video_frame.video_info()->width;
     gint height = video_frame.video_info()->height;
     
-    // Map buffer and create OpenCV image
-    GstMapInfo map;
-    if (!gst_buffer_map(buffer, &map, GST_MAP_READ))
-        return GST_PAD_PROBE_OK;
-    cv::Mat mat(height, width, CV_8UC4, map.data);
-    
     GstVideoRegionOfInterestMeta* rmeta;
     GstStructure *s;
     gint object_id;
     guint k = 0;
 
+    // Put back the regions that skipped classification
+    for (DeferredRegion &region : cache->TakeDeferred(GST_BUFFER_PTS(buffer))) {
+        auto new_roi = video_frame.add_region(region.x, region.y, region.w, region.h, region.label.c_str(),
+                                              region.confidence);
+        if (region.params)
+            gst_video_region_of_interest_meta_add_param(new_roi._meta(), region.params);
+    }
+
     // Iterate detected objects and all attributes (tensors)
     for (GVA::RegionOfInterest &roi : video_frame.regions()) {
         // Get GstVideoRegionOfInterestMeta from region
@@ -250,33 +297,43 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
         label += roi.label();
         label += "_";
  
-        for (auto tensor : roi.tensors()) {
-            string model_name = tensor.model_name();
-            string layer_name = tensor.layer_name();
-            vector<float> data = tensor.data<float>();
-
-            if (layer_name == "prob") {
-                label += (data[1] > 0.5) ? "_M" : "_F";
-            }
+        FaceAttributes face;
+        size_t tensors = face_post_processing.Process(roi._meta(), face);
+        // The AR SEI label table is small, the exact age and the emotion would fill it quickly
+        string attributes = face.stable_text;
+        // Objects that skipped classification get the attributes of their last classification
+        gint obj_id = -1;
+        GstStructure *object = gst_video_region_of_interest_meta_get_param(roi._meta(), OBJECT_PARAM);
+        if (object)
+            gst_structure_get_int(object, "obj_id", &obj_id);
+        if (obj_id >= 0) {
+            if (tensors > 0)
+                cache->Store(obj_id, attributes.c_str());
+            else
+                attributes = cache->Lookup(obj_id);
         }
+        label += attributes;
         
         rmeta = roi._meta();
         if (rmeta == NULL)
         	std::cout<<"Null pointer"<<std::endl;
 #if ENABLE_ARSEI_INSERTION
+        // Re-encode the object index, confidence and partial flag decoded from the input
+        s = gst_video_region_of_interest_meta_get_param (rmeta, "roi/arsei");
+        if (s == NULL) {
+            s = gst_structure_new ("roi/arsei", "obj_id", G_TYPE_INT, k, NULL);
+            gst_video_region_of_interest_meta_add_param (rmeta, s);
+        }
+        if (conf_bits > 0 && gst_structure_has_field (s, "confidence"))
+            gst_structure_set (s, "conf_length", G_TYPE_INT, conf_bits, NULL);
 #if ARSEI_INSERT_LABEL
-        s = gst_structure_new ("roi/arsei", "obj_id", G_TYPE_INT, k, "label", G_TYPE_STRING, label.c_str(), NULL);
-#else
-        s = gst_structure_new ("roi/arsei", "obj_id", G_TYPE_INT, roi.object_id()-1, NULL);
+        gst_structure_set (s, "label", G_TYPE_STRING, label.c_str(), NULL);
 #endif
-        gst_video_region_of_interest_meta_add_param (rmeta, s);
 #endif
         k++;        
 
     }
 
-    // Release the memory previously mapped with gst_buffer_map
-    gst_buffer_unmap(buffer, &map);
     // Unref a GstCaps and and free all its structures and the structures' values
     gst_caps_unref(caps);
     GST_PAD_PROBE_INFO_DATA(info) = buffer;
@@ -284,6 +341,243 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
     return GST_PAD_PROBE_OK;
 }
 
+// Builds the decode, classify and encode pipeline, stage_timer may be NULL
+static GstElement *create_pipeline(gchar const *video_source, gchar const *input, gboolean h264_icompression_scheme,
+                                   gboolean h264_ocompression_scheme, gchar const *sink, ClassificationCache *cache,
+                                   BranchMerger *merger, StageTimer *stage_timer) {
+    gchar const *preprocess_pipeline = NULL;
+    gchar const *enc_str = NULL;
+    gchar const *capfilter = NULL;
+    gchar const *vc_str = NULL;
+
+		if (h264_icompression_scheme == TRUE) {
+    	preprocess_pipeline = "h264parse ! msdkh264dec name=dec";
+    }
+    else {
+    	preprocess_pipeline = "h265parse ! msdkh265dec name=dec";
+    }
+
+    if (bgra) {
+        capfilter = "videoconvert name=vconv n-threads=4 ! videoscale name=vscale n-threads=4 ! capsfilter caps=\"video/x-raw,format=BGRA\"";
+        vc_str = "videoconvert name=econv n-threads=4 ! ";
+    } else {
+        // The inference pre-processing crops, scales and converts only the face patches of
+        // the NV12 frames, the encoder takes the decoded frames as they are
+        capfilter = "capsfilter caps=\"video/x-raw,format=NV12\"";
+        vc_str = "";
+    }
+
+		if (h264_ocompression_scheme == TRUE) {
+    	enc_str = "msdkh264enc name=msdkh264enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
+    }
+		else {
+    	enc_str = "msdkh265enc name=msdkh265enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
+    }
+
+    std::string branches;
+    std::string classify_str = ClassifierChain(classifiers, !serial_classifiers, branches);
+    auto launch_str = g_strdup_printf("%s=%s ! %s ! %s ! "
+                                      "%s ! %s%s ! %s%s",
+                                      video_source, input, preprocess_pipeline, capfilter, classify_str.c_str(), vc_str, enc_str, sink,
+                                      branches.c_str());
+
+    g_print("PIPELINE: %s \n", launch_str);
+    GstElement *pipeline = gst_parse_launch(launch_str, NULL);
+    g_free(launch_str);
+
+		// set probe callback
+		auto encoder = gst_bin_get_by_name(GST_BIN(pipeline), h264_ocompression_scheme ? "msdkh264enc" : "msdkh265enc");
+		auto pad = gst_element_get_static_pad(encoder, "sink");
+		// The provided callback 'pad_probe_callback' is called for every state that
+		// matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, cache, NULL);
+		gst_object_unref(pad);
+		gst_object_unref(encoder);
+
+		//Callback to convert gstreamer rois to DL-streamer rois
+		auto dbug = gst_bin_get_by_name(GST_BIN(pipeline), "dec");
+		auto dpad = gst_element_get_static_pad(dbug, "src");
+		// The provided callback 'pad_probe_callback' is called for every state that
+		// matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
+		gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, debug_probe_callback, cache, NULL);
+		gst_object_unref(dpad);
+		gst_object_unref(dbug);
+
+    // Tensors of parallel classifier branches go back onto the regions before the encoder probe
+    merger->Attach(pipeline);
+    if (pipeline_stats)
+        pipeline_stats->Attach(pipeline);
+    if (metrics_server) {
+        MetricsTaps taps = {"dec", {}, h264_ocompression_scheme ? "msdkh264enc" : "msdkh265enc",
+                            !h264_ocompression_scheme};
+        for (size_t i = 0; i < classifiers.size(); i++)
+            taps.inference.push_back("classify" + std::to_string(i));
+        metrics_server->Attach(pipeline, {taps});
+    }
+
+    if (stage_timer) {
+        for (const char *name : {"dec", "vconv", "vscale"})
+            stage_timer->AddStage(pipeline, name);
+        for (int i = 0; stage_timer->AddStage(pipeline, "classify" + std::to_string(i)); i++)
+            ;
+        for (const char *name : {"econv", "msdkh264enc", "msdkh265enc"})
+            stage_timer->AddStage(pipeline, name);
+    }
+
+    return pipeline;
+}
+
+// Pipelines of one job worker, one per codec combination
+struct JobWorker {
+    gboolean h264_icompression_scheme;
+    gboolean h264_ocompression_scheme;
+    // Before the pipelines so that they outlive their probes
+    std::map<std::string, std::unique_ptr<ClassificationCache>> caches;
+    std::map<std::string, std::unique_ptr<BranchMerger>> mergers;
+    std::map<std::string, std::unique_ptr<ReusablePipeline>> pipelines;
+
+    // Runs a job "input=<file> [incodec=h264|h265] [outcodec=h264|h265] [output=<file>]"
+    bool Run(const Job &job, std::string &error) {
+        auto input = job.find("input");
+        if (input == job.end()) {
+            error = "job has no input";
+            return false;
+        }
+        auto codec = [&](const char *key, gboolean h264_default) {
+            auto it = job.find(key);
+            return it != job.end() ? it->second : std::string(h264_default ? "h264" : "h265");
+        };
+        std::string incodec = codec("incodec", h264_icompression_scheme);
+        std::string outcodec = codec("outcodec", h264_ocompression_scheme);
+        for (const auto &c : {incodec, outcodec})
+            if (c != "h264" && c != "h265") {
+                error = "unsupported codec " + c;
+                return false;
+            }
+        auto output_it = job.find("output");
+        std::string output;
+        if (output_it != job.end()) {
+            output = output_it->second;
+        } else {
+            gchar *base = g_path_get_basename(input->second.c_str());
+            output = std::string("output/") + base + "." + outcodec;
+            g_free(base);
+        }
+
+        std::string key = incodec + "-" + outcodec;
+        auto &pipeline = pipelines[key];
+        auto &cache = caches[key];
+        if (!cache)
+            cache.reset(new ClassificationCache(reclassify_interval, reclassify_size));
+        auto &merger = mergers[key];
+        if (!merger)
+            merger.reset(new BranchMerger());
+        if (!pipeline || pipeline->broken()) {
+            pipeline.reset();
+            pipeline.reset(new ReusablePipeline(create_pipeline("filesrc name=src location", input->second.c_str(),
+                                                                incodec == "h264", outcodec == "h264",
+                                                                "filesink name=sink async=false location=/dev/null",
+                                                                cache.get(), merger.get(), NULL)));
+        }
+        // Object IDs start over with every input
+        cache->Clear();
+        merger->Clear();
+        return pipeline->Run(input->second, output, error);
+    }
+};
+
+static void write_pipeline_stats() {
+    if (pipeline_stats && !pipeline_stats->Write())
+        g_printerr("Can't write statistics to %s\n", stats_file);
+}
+
+static void print_cache_stats(uint64_t classified, uint64_t cached) {
+    if (reclassify_interval > 1)
+        g_print("Classified %" G_GUINT64_FORMAT " faces, %" G_GUINT64_FORMAT " taken from the cache (%.1f%%)\n",
+                (guint64)classified, (guint64)cached,
+                classified + cached ? 100.0 * cached / (classified + cached) : 0.0);
+}
+
+static void print_merge_stats(uint64_t misses) {
+    if (misses > 0)
+        g_print("%" G_GUINT64_FORMAT " frames went on without the results of every classifier branch\n",
+                (guint64)misses);
+}
+
+// Runs the given jobs on a pool of workers whose pipelines stay loaded between jobs, or
+// serves jobs from the job server if there are none
+static int run_jobs(const std::vector<Job> &jobs, gboolean h264_icompression_scheme,
+                    gboolean h264_ocompression_scheme) {
+    std::vector<std::unique_ptr<JobWorker>> job_workers;
+    std::mutex job_workers_mutex;
+    JobHandlerFactory make_handler = [&]() -> JobHandler {
+        std::lock_guard<std::mutex> lock(job_workers_mutex);
+        job_workers.emplace_back(new JobWorker{h264_icompression_scheme, h264_ocompression_scheme, {}, {}, {}});
+        JobWorker *job_worker = job_workers.back().get();
+        return [job_worker](const Job &job, std::string &error) { return job_worker->Run(job, error); };
+    };
+
+    if (jobs.empty()) {
+        int ret_code = RunJobServer(server_socket, spool_dir, make_handler());
+        write_pipeline_stats();
+        return ret_code;
+    }
+    int ret_code = RunJobPool(jobs, workers, make_handler);
+    uint64_t classified = 0, cached = 0, misses = 0;
+    for (const auto &job_worker : job_workers) {
+        for (const auto &cache : job_worker->caches) {
+            classified += cache.second->classified();
+            cached += cache.second->cached();
+        }
+        for (const auto &merger : job_worker->mergers)
+            misses += merger.second->misses();
+    }
+    print_cache_stats(classified, cached);
+    print_merge_stats(misses);
+    write_pipeline_stats();
+    return ret_code;
+}
+
+// Splits one long elementary stream at IDRs, processes the segments on the worker pool and
+// joins the outputs. The segments start with the AR SEI state of the input at their position,
+// the encoder starts every output with a cancel and the full AR SEI state.
+static int run_segments(const std::string &input, gboolean h264_icompression_scheme,
+                        gboolean h264_ocompression_scheme) {
+    GError *error = NULL;
+    gchar *dir = g_dir_make_tmp("classification_encode_XXXXXX", &error);
+    if (!dir) {
+        g_printerr("Can't create a directory for the segments: %s\n", error->message);
+        g_error_free(error);
+        return -1;
+    }
+    std::string outcodec = h264_ocompression_scheme ? "h264" : "h265";
+    std::vector<std::string> segment_files = SplitElementaryStream(input, !h264_icompression_scheme, segments, dir);
+    std::vector<std::string> outputs;
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < segment_files.size(); i++) {
+        outputs.push_back(std::string(dir) + "/output_" + std::to_string(i) + "." + outcodec);
+        jobs.push_back({{"input", segment_files[i]}, {"output", outputs.back()}});
+    }
+    g_print("Split %s into %zu segments\n", input.c_str(), segment_files.size());
+
+    int ret_code = run_jobs(jobs, h264_icompression_scheme, h264_ocompression_scheme);
+    if (ret_code == 0) {
+        gchar *base = g_path_get_basename(input.c_str());
+        std::string output = std::string("output/") + base + "." + outcodec;
+        g_free(base);
+        ConcatenateFiles(outputs, output);
+        g_print("Wrote %s\n", output.c_str());
+    }
+
+    for (const auto &file : segment_files)
+        g_remove(file.c_str());
+    for (const auto &file : outputs)
+        g_remove(file.c_str());
+    g_rmdir(dir);
+    g_free(dir);
+    return ret_code;
+}
+
 // The entry point for the GVA draw_face_attributes sample application
 // Sample recieves video with faces as an argument
 // If video file is not passed as an argument obviously, an attempt will be made
@@ -296,10 +590,7 @@ int main(int argc, char *argv[]) {
     GError *error = NULL;
     gboolean h264_icompression_scheme = FALSE;
     gboolean h264_ocompression_scheme = FALSE;
-    gchar const *preprocess_pipeline = NULL;
-    gchar const *enc_str = NULL;
     gchar const *sink = NULL;
-    gchar const *capfilter = "video/x-raw,format=BGRA";    
         
     if (!g_option_context_parse(context, &argc, &argv, &error)) {
         g_print("option parsing failed: %s\n", error->message);
@@ -309,21 +600,8 @@ int main(int argc, char *argv[]) {
 
     // If video file is not passed as an argument, an attempt will be made to use
     // camera
-    gchar const *video_source = NULL;
-    std::string input_str;
-    if (input_file) {
-        input_str = (input_file);
-        if (input_str.find("/dev/video") != std::string::npos) {
-            video_source = "v4l2src device";
-        } else if (input_str.find("://") != std::string::npos) {
-            video_source = "urisourcebin buffer-size=4096 uri";
-        } else {
-            video_source = "filesrc location";
-        }
-    } else {
+    if (!input_file)
         input_file = "/dev/video0";
-        video_source = "v4l2src device";
-    }
     
     // Compression scheme of the input & output files
     std::string icompr_str;
@@ -354,11 +632,27 @@ int main(int argc, char *argv[]) {
           h264_ocompression_scheme = TRUE;
     }    
     
+    // Several inputs go through one pipeline per worker, with one output file each
+    std::vector<std::string> inputs = ExpandInputList(input_file);
+    if ((inputs.size() > 1 || segments > 1) && workers <= 0)
+        workers = g_get_num_processors();
+    // A list or pattern with a single match runs like that file
+    if (inputs.size() == 1)
+        input_file = inputs[0].c_str();
+    gchar const *video_source = NULL;
+    std::string input_str = (input_file);
+    if (input_str.find("/dev/video") != std::string::npos) {
+        video_source = "v4l2src device";
+    } else if (input_str.find("://") != std::string::npos) {
+        video_source = "urisourcebin buffer-size=4096 uri";
+    } else {
+        video_source = "filesrc location";
+    }
+
     if (env_models_path.empty()) {
         throw std::runtime_error("Enviroment variable MODELS_PATH is not set");
     }
     std::map<std::string, std::string> model_paths;
-    std::string classify_str = "";
     if (detection_model == NULL) {
         for (const auto &model_to_path :
              FindModels(SplitString(env_models_path), default_detection_model_names, model_precision))
@@ -366,74 +660,67 @@ int main(int argc, char *argv[]) {
         detection_model = g_strdup(model_paths["face-detection-adas-0001.xml"].c_str());
     }
     if (classification_models == NULL) {
+        int i = 0;
         for (const auto &model_to_path :
-             FindModels(SplitString(env_models_path), default_classification_model_names, model_precision))
-            classify_str += "gvainference model=" + model_to_path.second + " device=" + device +
-                            " batch-size=" + std::to_string(batch_size) + " inference-region=roi-list ! queue ";
+             FindModels(SplitString(env_models_path), default_classification_model_names, model_precision)) {
+            if (!face_post_processing.AddModel(model_to_path.first))
+                g_print("No post-processing for %s, its results are not in the labels\n", model_to_path.first.c_str());
+            classifiers.push_back("gvainference name=classify" + std::to_string(i++) + " model=" + model_to_path.second +
+                                  " device=" + device + " batch-size=" + std::to_string(batch_size) +
+                                  " inference-region=roi-list" + (bgra ? "" : " pre-process-backend=ie") +
+                                  " model-instance-id=" + model_to_path.first + SharedInstanceOptions(workers, device));
+        }
     }
 
-		if (h264_icompression_scheme == TRUE) {
-    	preprocess_pipeline = "h264parse ! msdkh264dec ! videoconvert name=vconv n-threads=4 ! videoscale n-threads=4 ";
+    std::unique_ptr<PipelineStats> stats;
+    if (stats_file) {
+        stats.reset(new PipelineStats(stats_file, stats_interval));
+        pipeline_stats = stats.get();
     }
-    else {
-    	preprocess_pipeline = "h265parse ! msdkh265dec ! videoconvert name=vconv n-threads=4 ! videoscale n-threads=4 ";
+    std::unique_ptr<MetricsServer> metrics;
+    if (metrics_address) {
+        try {
+            metrics.reset(new MetricsServer(metrics_address));
+        } catch (const std::exception &e) {
+            g_printerr("%s\n", e.what());
+            return 1;
+        }
+        metrics_server = metrics.get();
     }
 
+    if (server_socket || spool_dir)
+        return run_jobs({}, h264_icompression_scheme, h264_ocompression_scheme);
+    if (inputs.size() > 1) {
+        std::vector<Job> jobs;
+        for (const auto &input : inputs)
+            jobs.push_back({{"input", input}});
+        return run_jobs(jobs, h264_icompression_scheme, h264_ocompression_scheme);
+    }
+    if (segments > 1)
+        return run_segments(inputs[0], h264_icompression_scheme, h264_ocompression_scheme);
+
 #if ENABLE_ARSEI_INSERTION
 		if (h264_ocompression_scheme == TRUE) {
-    	enc_str = "msdkh264enc name=msdkh264enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
     	sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_classification_with_sei.h264";
     }
 		else {
-    	enc_str = "msdkh265enc name=msdkh265enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
     	sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_classification_with_sei.h265";
     }
 #else
 		if (h264_ocompression_scheme == TRUE) {
-    	enc_str = "msdkh264enc name=msdkh264enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
     	sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_classification_without_sei.h264";
     }
 		else {
-    	enc_str = "msdkh265enc name=msdkh265enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
     	sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_classification_without_sei.h265";
     }
 #endif
 
-    gchar const *vc_str = "videoconvert n-threads=4";
-    auto launch_str = g_strdup_printf("%s=%s ! %s ! capsfilter caps=\"%s\" !"
-                                      "%s ! %s ! %s ! %s",
-                                      video_source, input_file, preprocess_pipeline, capfilter, classify_str.c_str(), vc_str, enc_str, sink);
-
-    g_print("PIPELINE: %s \n", launch_str);
-    GstElement *pipeline = gst_parse_launch(launch_str, NULL);
-    g_free(launch_str);
-
-		if (h264_ocompression_scheme == TRUE) {
-		  // set probe callback
-		  auto msdkh264enc = gst_bin_get_by_name(GST_BIN(pipeline), "msdkh264enc");
-		  auto pad = gst_element_get_static_pad(msdkh264enc, "sink");
-		  // The provided callback 'pad_probe_callback' is called for every state that
-		  // matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-		  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, NULL, NULL);
-		  gst_object_unref(pad);
-    }
-    else {
-		  // set probe callback
-		  auto msdkh265enc = gst_bin_get_by_name(GST_BIN(pipeline), "msdkh265enc");
-		  auto pad = gst_element_get_static_pad(msdkh265enc, "sink");
-		  // The provided callback 'pad_probe_callback' is called for every state that
-		  // matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-		  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, NULL, NULL);
-		  gst_object_unref(pad);    
-    }
-
-		//Callback to convert gstreamer rois to DL-streamer rois
-		auto dbug = gst_bin_get_by_name(GST_BIN(pipeline), "vconv");
-		auto dpad = gst_element_get_static_pad(dbug, "sink");
-		// The provided callback 'pad_probe_callback' is called for every state that
-		// matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-		gst_pad_add_probe(dpad, GST_PAD_PROBE_TYPE_BUFFER, debug_probe_callback, NULL, NULL);
-		gst_object_unref(dpad);
+    ClassificationCache cache(reclassify_interval, reclassify_size);
+    BranchMerger merger;
+    StageTimer stage_timer;
+    GstElement *pipeline = create_pipeline(video_source, input_file, h264_icompression_scheme, h264_ocompression_scheme, sink,
+                                           &cache, &merger, stage_timings ? &stage_timer : NULL);
+    gint64 start_time = g_get_monotonic_time();
     
     // Start playing
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
@@ -461,6 +748,14 @@ int main(int argc, char *argv[]) {
     if (msg)
         gst_message_unref(msg);
 
+    print_cache_stats(cache.classified(), cache.cached());
+    print_merge_stats(merger.misses());
+    if (stage_timings) {
+        g_print("%s path, %.2f s in total\n", bgra ? "BGRA" : "NV12", (g_get_monotonic_time() - start_time) / 1e6);
+        stage_timer.Print();
+    }
+    write_pipeline_stats();
+
     // Free resources
     gst_object_unref(bus);
     gst_element_set_state(pipeline, GST_STATE_NULL);
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "box_log.h"
+
+#include <fstream>
+#include <sstream>
+
+// Minimum IoU for a box to count as a detection of the reference box
+#define MATCH_IOU 0.5
+
+void BoxLog::Add(uint64_t pts, const SmoothedBox &box) {
+    std::lock_guard<std::mutex> lock(mutex);
+    frames[pts].push_back(box);
+}
+
+bool BoxLog::Save(const std::string &path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream out(path);
+    out << "# pts x y w h\n";
+    for (const auto &frame : frames)
+        for (const auto &box : frame.second)
+            out << frame.first << " " << box.x << " " << box.y << " " << box.w << " " << box.h << "\n";
+    return bool(out);
+}
+
+bool BoxLog::Load(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    frames.clear();
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        uint64_t pts;
+        SmoothedBox box;
+        if (fields >> pts >> box.x >> box.y >> box.w >> box.h)
+            frames[pts].push_back(box);
+    }
+    return true;
+}
+
+BoxAccuracy BoxLog::Compare(const BoxLog &reference) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::lock_guard<std::mutex> reference_lock(reference.mutex);
+    BoxAccuracy accuracy = {0, 0, 0, 0, 0.0};
+    double iou_sum = 0;
+    static const std::vector<SmoothedBox> none;
+
+    for (const auto &frame : reference.frames) {
+        auto it = frames.find(frame.first);
+        const std::vector<SmoothedBox> &boxes = it != frames.end() ? it->second : none;
+        accuracy.frames++;
+        accuracy.reference += frame.second.size();
+
+        std::vector<bool> used(boxes.size(), false);
+        for (const auto &expected : frame.second) {
+            double best = MATCH_IOU;
+            int best_index = -1;
+            for (size_t i = 0; i < boxes.size(); i++) {
+                double iou = BoxIoU(expected, boxes[i]);
+                if (!used[i] && iou >= best) {
+                    best = iou;
+                    best_index = i;
+                }
+            }
+            if (best_index >= 0) {
+                used[best_index] = true;
+                accuracy.matched++;
+                iou_sum += best;
+            }
+        }
+        for (bool u : used)
+            if (!u)
+                accuracy.extra++;
+    }
+    accuracy.mean_iou = accuracy.matched ? iou_sum / accuracy.matched : 0.0;
+    return accuracy;
+}
@@ -0,0 +1,48 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "box_smoother.h"
+
+struct BoxAccuracy {
+    uint64_t frames;    // frames present in both logs
+    uint64_t reference; // boxes in the reference
+    uint64_t matched;   // reference boxes matched with IoU >= 0.5
+    uint64_t extra;     // boxes without a reference box
+    double mean_iou;    // over the matched boxes
+
+    double recall() const {
+        return reference ? double(matched) / reference : 1.0;
+    }
+    double precision() const {
+        return matched + extra ? double(matched) / (matched + extra) : 1.0;
+    }
+};
+
+// Boxes of every frame of a run, keyed by presentation timestamp. A run with full detection
+// saved with Save() is the reference that runs with other settings are compared against.
+class BoxLog {
+  public:
+    void Add(uint64_t pts, const SmoothedBox &box);
+
+    // Return false if the file can't be written or read
+    bool Save(const std::string &path) const;
+    bool Load(const std::string &path);
+
+    // Matches the boxes of every frame greedily by IoU
+    BoxAccuracy Compare(const BoxLog &reference) const;
+
+  private:
+    mutable std::mutex mutex;
+    std::map<uint64_t, std::vector<SmoothedBox>> frames;
+};
@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "box_smoother.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Tracks not updated for this many frames are forgotten
+#define TRACK_EXPIRY_FRAMES 30
+
+double BoxIoU(const SmoothedBox &a, const SmoothedBox &b) {
+    int x0 = std::max(a.x, b.x);
+    int y0 = std::max(a.y, b.y);
+    int x1 = std::min(a.x + a.w, b.x + b.w);
+    int y1 = std::min(a.y + a.h, b.y + b.h);
+    double inter = (x1 > x0 && y1 > y0) ? double(x1 - x0) * (y1 - y0) : 0.0;
+    double uni = double(a.w) * a.h + double(b.w) * b.h - inter;
+    return uni > 0 ? inter / uni : 1.0;
+}
+
+BoxSmoother::BoxSmoother(int grid, double alpha, int hysteresis)
+    : grid(std::max(grid, 1)), alpha(std::min(std::max(alpha, 0.0), 1.0)), hysteresis(std::max(hysteresis, 0)) {
+}
+
+bool BoxSmoother::enabled() const {
+    return grid > 1 || alpha < 1.0 || hysteresis > 0;
+}
+
+int BoxSmoother::Quantize(double v) const {
+    return static_cast<int>(std::lround(v / grid)) * grid;
+}
+
+SmoothedBox BoxSmoother::Apply(int track_id, int x, int y, int w, int h) {
+    SmoothedBox raw = {x, y, w, h};
+    auto it = tracks.find(track_id);
+    if (it == tracks.end()) {
+        Track track = {double(x), double(y), double(w), double(h), {}, frame};
+        track.out = {Quantize(x), Quantize(y), std::max(Quantize(w), grid), std::max(Quantize(h), grid)};
+        it = tracks.emplace(track_id, track).first;
+    } else {
+        Track &track = it->second;
+        track.x += alpha * (x - track.x);
+        track.y += alpha * (y - track.y);
+        track.w += alpha * (w - track.w);
+        track.h += alpha * (h - track.h);
+        track.last_frame = frame;
+
+        SmoothedBox next = {Quantize(track.x), Quantize(track.y), std::max(Quantize(track.w), grid),
+                            std::max(Quantize(track.h), grid)};
+        // Compare edges rather than size so that a box growing on one side counts as a move
+        int moved = std::max({std::abs(next.x - track.out.x), std::abs(next.y - track.out.y),
+                              std::abs(next.x + next.w - track.out.x - track.out.w),
+                              std::abs(next.y + next.h - track.out.y - track.out.h)});
+        if (moved > hysteresis)
+            track.out = next;
+    }
+
+    iou_sum += BoxIoU(raw, it->second.out);
+    num_boxes++;
+    return it->second.out;
+}
+
+void BoxSmoother::EndFrame() {
+    for (auto it = tracks.begin(); it != tracks.end();) {
+        if (frame - it->second.last_frame > TRACK_EXPIRY_FRAMES)
+            it = tracks.erase(it);
+        else
+            ++it;
+    }
+    frame++;
+}
+
+void BoxSmoother::Reset() {
+    tracks.clear();
+}
+
+double BoxSmoother::MeanIoU() const {
+    return num_boxes ? iou_sum / num_boxes : 1.0;
+}
+
+uint64_t BoxSmoother::boxes() const {
+    return num_boxes;
+}
@@ -0,0 +1,61 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+struct SmoothedBox {
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// Intersection over union of two boxes
+double BoxIoU(const SmoothedBox &a, const SmoothedBox &b);
+
+// Stabilizes per-track boxes before they are handed to the encoder as AR SEI objects.
+// Raw boxes are filtered with an exponential moving average, snapped to a pixel grid and
+// only replace the previously emitted box when one of its edges moves more than the
+// hysteresis threshold, so the encoder sees identical boxes while an object is still.
+class BoxSmoother {
+  public:
+    BoxSmoother(int grid, double alpha, int hysteresis);
+
+    // True if any of quantization, smoothing or hysteresis is configured
+    bool enabled() const;
+
+    SmoothedBox Apply(int track_id, int x, int y, int w, int h);
+
+    // Drops tracks that have not been seen for a while, call once per frame
+    void EndFrame();
+
+    // Forgets all tracks, for the start of a new input. The statistics are kept.
+    void Reset();
+
+    // Mean IoU of emitted boxes against the raw detector boxes
+    double MeanIoU() const;
+    uint64_t boxes() const;
+
+  private:
+    struct Track {
+        double x, y, w, h;
+        SmoothedBox out;
+        uint64_t last_frame;
+    };
+
+    int Quantize(double v) const;
+
+    int grid;
+    double alpha;
+    int hysteresis;
+    uint64_t frame = 0;
+    uint64_t num_boxes = 0;
+    double iou_sum = 0;
+    std::unordered_map<int, Track> tracks;
+};
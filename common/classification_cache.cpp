@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "classification_cache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+ClassificationCache::ClassificationCache(guint reclassify_interval, double size_change)
+    : reclassify_interval(reclassify_interval), size_change(std::max(size_change, 0.0)) {
+}
+
+ClassificationCache::~ClassificationCache() {
+    Clear();
+}
+
+bool ClassificationCache::enabled() const {
+    return reclassify_interval > 1;
+}
+
+bool ClassificationCache::NeedsClassification(int obj_id, int w, int h) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled() || obj_id < 0) {
+        num_classified++;
+        return true;
+    }
+    auto it = entries.find(obj_id);
+    if (it != entries.end()) {
+        Entry &entry = it->second;
+        entry.last_frame = frame;
+        bool resized = size_change > 0 && (std::abs(w - entry.w) > size_change * entry.w ||
+                                           std::abs(h - entry.h) > size_change * entry.h);
+        if (!resized && frame - entry.classified_frame < reclassify_interval) {
+            num_cached++;
+            return false;
+        }
+    }
+    // The attributes of an earlier classification stay until the new one is stored
+    Entry &entry = entries[obj_id];
+    entry.w = w;
+    entry.h = h;
+    entry.classified_frame = frame;
+    entry.last_frame = frame;
+    num_classified++;
+    return true;
+}
+
+void ClassificationCache::Defer(GstClockTime pts, const DeferredRegion &region) {
+    std::lock_guard<std::mutex> lock(mutex);
+    deferred[pts].push_back(region);
+}
+
+void ClassificationCache::EndFrame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    // AR SEI object indices are freed when the object leaves and reused for the next new one,
+    // so an index missing from a frame belongs to another object when it comes back
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.last_frame != frame)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+    frame++;
+}
+
+std::vector<DeferredRegion> ClassificationCache::TakeDeferred(GstClockTime pts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<DeferredRegion> regions;
+    auto it = deferred.find(pts);
+    if (it != deferred.end()) {
+        regions.swap(it->second);
+        deferred.erase(it);
+    }
+    return regions;
+}
+
+void ClassificationCache::Store(int obj_id, const char *attributes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(obj_id);
+    if (it != entries.end())
+        it->second.attributes = attributes;
+}
+
+std::string ClassificationCache::Lookup(int obj_id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(obj_id);
+    return it != entries.end() ? it->second.attributes : std::string();
+}
+
+size_t ClassificationCache::Lookup(int obj_id, char *attributes, size_t size) const {
+    if (size == 0)
+        return 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(obj_id);
+    size_t length = it != entries.end() ? std::min(it->second.attributes.size(), size - 1) : 0;
+    if (length > 0)
+        memcpy(attributes, it->second.attributes.data(), length);
+    attributes[length] = '\0';
+    return length;
+}
+
+void ClassificationCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &frame_regions : deferred)
+        for (auto &region : frame_regions.second)
+            if (region.params)
+                gst_structure_free(region.params);
+    deferred.clear();
+    entries.clear();
+}
+
+uint64_t ClassificationCache::classified() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_classified;
+}
+
+uint64_t ClassificationCache::cached() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_cached;
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Region taken off a frame before classification because its object is still in the cache
+struct DeferredRegion {
+    int x, y, w, h;
+    std::string label;
+    double confidence;
+    GstStructure *params; // owned, "roi/arsei" of the region
+    int obj_id;
+};
+
+// Classification results by tracked object ID. Before classification, regions of known
+// objects are taken off the frame with Defer() and skip the inference; after
+// classification TakeDeferred() returns them to be put back with the cached attributes.
+// An object is classified again after reclassify_interval frames or when the width or
+// height of its box changed by more than size_change since it was last classified. An object
+// missing from a frame is forgotten.
+class ClassificationCache {
+  public:
+    ClassificationCache(guint reclassify_interval, double size_change);
+    ~ClassificationCache();
+
+    // False if every region is classified on every frame
+    bool enabled() const;
+
+    // True if the object has to be classified on the current frame. Objects without an ID
+    // (obj_id < 0) are always classified.
+    bool NeedsClassification(int obj_id, int w, int h);
+    // Keeps the region of the frame with the given timestamp until TakeDeferred()
+    void Defer(GstClockTime pts, const DeferredRegion &region);
+    // Call once per frame before classification, after NeedsClassification() for all of its
+    // regions
+    void EndFrame();
+
+    std::vector<DeferredRegion> TakeDeferred(GstClockTime pts);
+    void Store(int obj_id, const char *attributes);
+    // Attributes of the last classification, empty if there was none
+    std::string Lookup(int obj_id) const;
+    // Same into a buffer of size bytes, truncated to fit. Returns the length copied.
+    size_t Lookup(int obj_id, char *attributes, size_t size) const;
+
+    // Forgets all objects, for the start of a new stream
+    void Clear();
+
+    uint64_t classified() const;
+    uint64_t cached() const;
+
+  private:
+    struct Entry {
+        std::string attributes;
+        int w, h;
+        uint64_t classified_frame;
+        uint64_t last_frame;
+    };
+
+    guint reclassify_interval;
+    double size_change;
+    mutable std::mutex mutex;
+    uint64_t frame = 0;
+    uint64_t num_classified = 0;
+    uint64_t num_cached = 0;
+    std::unordered_map<int, Entry> entries;
+    std::map<GstClockTime, std::vector<DeferredRegion>> deferred;
+};
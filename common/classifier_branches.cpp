@@ -0,0 +1,252 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "classifier_branches.h"
+
+#include <algorithm>
+#include <chrono>
+#include <gst/video/gstvideometa.h>
+
+#define SPLIT_NAME "classify_split"
+#define MERGE_NAME "classify_merge"
+
+// Frames the main branch can run ahead of the classifiers. Raw frames, so limited by count
+// only; has to be larger than the inference batch size.
+#define MERGE_QUEUE_BUFFERS 64
+// A frame goes on without the missing results after about the time the branches need for a
+// full merge queue, e.g. when a branch fails. This long if the frames have no duration.
+#define MERGE_TIMEOUT_MS 5000
+#define MERGE_MIN_TIMEOUT_MS 200
+
+std::string ClassifierChain(const std::vector<std::string> &classifiers, bool parallel, std::string &branches) {
+    branches.clear();
+    std::string chain;
+    if (!parallel || classifiers.size() < 2) {
+        for (const auto &classifier : classifiers)
+            chain += (chain.empty() ? "" : " ! ") + classifier + " ! queue";
+        return chain;
+    }
+    for (size_t i = 0; i < classifiers.size(); i++)
+        branches += " " SPLIT_NAME ". ! queue ! " + classifiers[i] + " ! fakesink name=" CLASSIFIER_BRANCH_PREFIX +
+                    std::to_string(i) + " sync=false async=false";
+    return "tee name=" SPLIT_NAME " ! queue name=" MERGE_NAME " max-size-buffers=" +
+           std::to_string(MERGE_QUEUE_BUFFERS) + " max-size-bytes=0 max-size-time=0";
+}
+
+BranchMerger::~BranchMerger() {
+    Clear();
+}
+
+bool BranchMerger::Attach(GstElement *pipeline) {
+    GstElement *merge = gst_bin_get_by_name(GST_BIN(pipeline), MERGE_NAME);
+    if (!merge)
+        return false;
+    GstElement *split = gst_bin_get_by_name(GST_BIN(pipeline), SPLIT_NAME);
+    GstPad *split_pad = gst_element_get_static_pad(split, "sink");
+    gst_pad_add_probe(split_pad, GST_PAD_PROBE_TYPE_BUFFER, Split, this, NULL);
+    gst_object_unref(split_pad);
+    gst_object_unref(split);
+    for (size_t i = 0;; i++) {
+        std::string name = CLASSIFIER_BRANCH_PREFIX + std::to_string(i);
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), name.c_str());
+        if (!sink)
+            break;
+        branches.emplace_back(new Branch{this, i});
+        GstPad *pad = gst_element_get_static_pad(sink, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, Collect, branches.back().get(), NULL);
+        gst_object_unref(pad);
+        gst_object_unref(sink);
+    }
+    GstPad *pad = gst_element_get_static_pad(merge, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, Merge, this, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(merge);
+    return true;
+}
+
+void BranchMerger::Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &frame : frames)
+        FreeFrame(frame.second);
+    frames.clear();
+    generation++;
+    // Timestamps start again with the new stream
+    for (auto &branch : branches) {
+        branch->last_pts = GST_CLOCK_TIME_NONE;
+        branch->stalled = false;
+    }
+    merging_pts = GST_CLOCK_TIME_NONE;
+    reported.notify_all();
+}
+
+void BranchMerger::FreeFrame(Frame &frame) {
+    for (auto &region : frame.regions)
+        for (GstStructure *tensor : region.tensors)
+            gst_structure_free(tensor);
+    frame.regions.clear();
+}
+
+// In front of the tee: notes how many parameters every region has before the branches add theirs
+GstPadProbeReturn BranchMerger::Split(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    BranchMerger *merger = static_cast<BranchMerger *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    std::vector<guint> params;
+    gpointer state = NULL;
+    GstMeta *meta;
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE)))
+        params.push_back(g_list_length(reinterpret_cast<GstVideoRegionOfInterestMeta *>(meta)->params));
+
+    std::lock_guard<std::mutex> lock(merger->mutex);
+    merger->frames[GST_BUFFER_PTS(buffer)].params_before.swap(params);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn BranchMerger::Collect(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Branch *branch = static_cast<Branch *>(user_data);
+    BranchMerger *merger = branch->merger;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    std::vector<guint> params_before;
+    {
+        std::lock_guard<std::mutex> lock(merger->mutex);
+        auto it = merger->frames.find(GST_BUFFER_PTS(buffer));
+        if (it != merger->frames.end())
+            params_before = it->second.params_before;
+    }
+
+    // Copy the tensors outside the lock. The branch appended them to the parameters the region
+    // had in front of the tee, which are on the main branch already.
+    std::vector<RegionTensors> regions;
+    gpointer state = NULL;
+    GstMeta *meta;
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+        auto roi = reinterpret_cast<GstVideoRegionOfInterestMeta *>(meta);
+        RegionTensors region = {roi->roi_type, roi->x, roi->y, roi->w, roi->h, {}};
+        GList *l = roi->params;
+        if (regions.size() < params_before.size())
+            l = g_list_nth(l, params_before[regions.size()]);
+        for (; l; l = l->next) {
+            GstStructure *param = static_cast<GstStructure *>(l->data);
+            if (gst_structure_has_field(param, "layer_name"))
+                region.tensors.push_back(gst_structure_copy(param));
+        }
+        regions.push_back(std::move(region));
+    }
+
+    std::lock_guard<std::mutex> lock(merger->mutex);
+    Frame &frame = merger->frames[GST_BUFFER_PTS(buffer)];
+    if (frame.regions.empty())
+        frame.regions.swap(regions);
+    else
+        for (size_t i = 0; i < regions.size() && i < frame.regions.size(); i++) {
+            auto &tensors = frame.regions[i].tensors;
+            tensors.insert(tensors.end(), regions[i].tensors.begin(), regions[i].tensors.end());
+            regions[i].tensors.clear();
+        }
+    // Regions that didn't match up
+    for (auto &region : regions)
+        for (GstStructure *tensor : region.tensors)
+            gst_structure_free(tensor);
+    frame.reported++;
+    branch->last_pts = GST_BUFFER_PTS(buffer);
+    if (branch->stalled && GST_CLOCK_TIME_IS_VALID(merger->merging_pts) && branch->last_pts >= merger->merging_pts)
+        branch->stalled = false;
+    merger->reported.notify_all();
+    return GST_PAD_PROBE_OK;
+}
+
+bool BranchMerger::Passed(GstClockTime pts) const {
+    for (const auto &branch : branches)
+        if (!branch->stalled && (!GST_CLOCK_TIME_IS_VALID(branch->last_pts) || branch->last_pts < pts))
+            return false;
+    return true;
+}
+
+std::chrono::microseconds BranchMerger::Timeout(GstBuffer *buffer) const {
+    if (!GST_BUFFER_DURATION_IS_VALID(buffer))
+        return std::chrono::milliseconds(MERGE_TIMEOUT_MS);
+    // Time for the frames of a full merge queue, at least twice the longest complete wait so far
+    gint64 timeout = MERGE_QUEUE_BUFFERS * (gint64)(GST_BUFFER_DURATION(buffer) / GST_USECOND);
+    timeout = std::max(timeout, 2 * longest_wait);
+    timeout = std::min(std::max(timeout, (gint64)MERGE_MIN_TIMEOUT_MS * 1000), (gint64)MERGE_TIMEOUT_MS * 1000);
+    return std::chrono::microseconds(timeout);
+}
+
+// Called with the lock held when the frame at pts goes on without all results
+void BranchMerger::Miss(GstClockTime pts) {
+    // Branches behind the frame aren't waited for until they catch up, they may have failed
+    for (auto &branch : branches)
+        if (!GST_CLOCK_TIME_IS_VALID(branch->last_pts) || branch->last_pts < pts)
+            branch->stalled = true;
+    if (num_misses++ == 0)
+        g_printerr("Classifier branch results missing for the frame at %" GST_TIME_FORMAT
+                   ", frames go on without the results of late branches\n",
+                   GST_TIME_ARGS(pts));
+}
+
+GstPadProbeReturn BranchMerger::Merge(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    BranchMerger *merger = static_cast<BranchMerger *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+    Frame frame;
+    {
+        std::unique_lock<std::mutex> lock(merger->mutex);
+        guint64 generation = merger->generation;
+        gint64 wait_start = g_get_monotonic_time();
+        merger->merging_pts = pts;
+        // Branches run in order, one that reported a later frame has dropped this one
+        merger->reported.wait_for(lock, merger->Timeout(buffer),
+                                  [&] { return generation != merger->generation || merger->Passed(pts); });
+        // Results of earlier frames came too late, the main branch has passed them
+        auto it = merger->frames.begin();
+        for (; it != merger->frames.end() && it->first < pts; it = merger->frames.erase(it))
+            FreeFrame(it->second);
+        bool found = it != merger->frames.end() && it->first == pts;
+        if (found && it->second.reported >= merger->branches.size())
+            merger->longest_wait = std::max(merger->longest_wait, g_get_monotonic_time() - wait_start);
+        else if (generation == merger->generation)
+            merger->Miss(pts);
+        if (!found)
+            return GST_PAD_PROBE_OK;
+        frame.regions.swap(it->second.regions);
+        merger->frames.erase(it);
+    }
+
+    // The tee may still share the buffer with the branches
+    buffer = gst_buffer_make_writable(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    // All branches had the same regions as the main branch, in the same order
+    size_t i = 0;
+    gpointer state = NULL;
+    GstMeta *meta;
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+        auto roi = reinterpret_cast<GstVideoRegionOfInterestMeta *>(meta);
+        if (i >= frame.regions.size())
+            break;
+        RegionTensors &region = frame.regions[i++];
+        if (region.roi_type != roi->roi_type || region.x != roi->x || region.y != roi->y || region.w != roi->w ||
+            region.h != roi->h)
+            continue;
+        // The meta takes the tensors over
+        for (GstStructure *tensor : region.tensors)
+            gst_video_region_of_interest_meta_add_param(roi, tensor);
+        region.tensors.clear();
+    }
+    FreeFrame(frame);
+    return GST_PAD_PROBE_OK;
+}
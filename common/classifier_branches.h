@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Name prefix of the fakesinks that end the parallel classifier branches
+#define CLASSIFIER_BRANCH_PREFIX "classify_branch"
+
+// Launch string part running the classification elements on the frames. Serial, they follow
+// each other in the stream and the frame latency is the sum of their latencies. In parallel a
+// tee feeds every classifier on a branch with its own streaming thread, the branches end in
+// fakesinks and a BranchMerger puts their tensors on the regions of the main branch. The
+// latency is that of the slowest classifier. The parallel branches have to be appended to the
+// end of the launch string.
+std::string ClassifierChain(const std::vector<std::string> &classifiers, bool parallel, std::string &branches);
+
+// Waits in the main branch of a parallel ClassifierChain until every classifier branch is
+// done with a frame and copies their tensors onto the same regions. Regions are matched by
+// their position in the frame. Only the parameters a branch added to a region are copied,
+// those the region had in front of the tee are on the main branch already. A frame waits about
+// as long as the branches need to work off a full merge queue; a branch that misses it is not
+// waited for again until it has caught up.
+class BranchMerger {
+  public:
+    ~BranchMerger();
+
+    // Installs the probes, returns false if the pipeline has no parallel classifier branches
+    bool Attach(GstElement *pipeline);
+
+    // Drops the results of frames not merged yet, for a new stream
+    void Clear();
+
+    // Frames that went on without the results of every branch
+    guint64 misses() const {
+        return num_misses;
+    }
+
+  private:
+    // Tensors of one region from one branch
+    struct RegionTensors {
+        GQuark roi_type;
+        guint x, y, w, h;
+        std::vector<GstStructure *> tensors; // owned
+    };
+    struct Frame {
+        size_t reported = 0;
+        std::vector<guint> params_before; // parameters of every region in front of the tee
+        std::vector<RegionTensors> regions;
+    };
+    struct Branch {
+        BranchMerger *merger;
+        size_t index;
+        GstClockTime last_pts = GST_CLOCK_TIME_NONE; // branches report their frames in order
+        bool stalled = false;                        // missed a frame and hasn't caught up yet
+    };
+
+    static GstPadProbeReturn Split(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn Collect(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn Merge(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void FreeFrame(Frame &frame);
+    // True if every branch that is waited for reported pts or a later frame
+    bool Passed(GstClockTime pts) const;
+    std::chrono::microseconds Timeout(GstBuffer *buffer) const;
+    void Miss(GstClockTime pts);
+
+    std::vector<std::unique_ptr<Branch>> branches;
+    std::mutex mutex;
+    std::condition_variable reported;
+    std::map<GstClockTime, Frame> frames;
+    guint64 generation = 0;
+    GstClockTime merging_pts = GST_CLOCK_TIME_NONE; // frame the main branch waits for
+    gint64 longest_wait = 0;                         // in us, of a frame that got all results
+    guint64 num_misses = 0;
+};
@@ -0,0 +1,382 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "es_segmenter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+// SEI payload type of annotated regions, the same in H.264 and H.265
+#define SEI_ANNOTATED_REGIONS 202
+
+namespace {
+
+struct Nal {
+    size_t start;  // first byte of the start code
+    size_t header; // first byte of the NAL unit header
+    size_t end;
+};
+
+enum NalKind { NAL_OTHER, NAL_SLICE, NAL_IDR, NAL_SEI, NAL_PARAMETER_SET, NAL_AUD };
+
+struct NalInfo {
+    NalKind kind;
+    bool first_slice; // first slice of a picture
+};
+
+// Position of the next 00 00 01 start code at or after pos, size if there is none
+size_t FindStartCode(const guint8 *data, size_t size, size_t pos) {
+    while (pos + 3 <= size) {
+        const guint8 *one = static_cast<const guint8 *>(memchr(data + pos + 2, 1, size - pos - 2));
+        if (!one)
+            break;
+        size_t i = one - data - 2;
+        if (data[i] == 0 && data[i + 1] == 0)
+            return i;
+        pos = i + 1;
+    }
+    return size;
+}
+
+bool NextNal(const guint8 *data, size_t size, size_t pos, Nal &nal) {
+    size_t i = FindStartCode(data, size, pos);
+    if (i == size)
+        return false;
+    nal.start = (i > pos && data[i - 1] == 0) ? i - 1 : i;
+    nal.header = i + 3;
+    size_t next = FindStartCode(data, size, nal.header);
+    // The leading zero byte of a 4 byte start code belongs to the next NAL unit
+    nal.end = (next < size && next > nal.header && data[next - 1] == 0) ? next - 1 : next;
+    return nal.header < nal.end;
+}
+
+NalInfo Classify(const guint8 *data, const Nal &nal, bool h265) {
+    size_t header_size = h265 ? 2 : 1;
+    if (nal.end - nal.header <= header_size)
+        return {NAL_OTHER, false};
+    bool first_slice = (data[nal.header + header_size] & 0x80) != 0;
+    if (h265) {
+        guint type = (data[nal.header] >> 1) & 0x3f;
+        if (type == 19 || type == 20)
+            return {NAL_IDR, first_slice};
+        if (type < 32)
+            return {NAL_SLICE, first_slice};
+        if (type >= 32 && type <= 34)
+            return {NAL_PARAMETER_SET, false};
+        if (type == 35)
+            return {NAL_AUD, false};
+        if (type == 39)
+            return {NAL_SEI, false};
+        return {NAL_OTHER, false};
+    }
+    guint type = data[nal.header] & 0x1f;
+    if (type == 5)
+        return {NAL_IDR, first_slice};
+    if (type >= 1 && type <= 4)
+        return {NAL_SLICE, first_slice};
+    if (type == 7 || type == 8)
+        return {NAL_PARAMETER_SET, false};
+    if (type == 9)
+        return {NAL_AUD, false};
+    if (type == 6)
+        return {NAL_SEI, false};
+    return {NAL_OTHER, false};
+}
+
+// Removes the emulation prevention bytes
+std::string ToRbsp(const guint8 *data, size_t size) {
+    std::string rbsp;
+    rbsp.reserve(size);
+    guint zeros = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (zeros >= 2 && data[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = data[i] == 0 ? zeros + 1 : 0;
+        rbsp.push_back(data[i]);
+    }
+    return rbsp;
+}
+
+// Inserts the emulation prevention bytes
+std::string ToEbsp(const std::string &rbsp) {
+    std::string ebsp;
+    guint zeros = 0;
+    for (unsigned char byte : rbsp) {
+        if (zeros >= 2 && byte <= 3) {
+            ebsp.push_back(3);
+            zeros = 0;
+        }
+        zeros = byte == 0 ? zeros + 1 : 0;
+        ebsp.push_back(byte);
+    }
+    return ebsp;
+}
+
+// Reads an RBSP bit by bit, past its end as zeros
+class BitReader {
+  public:
+    explicit BitReader(const std::string &rbsp) : rbsp(rbsp) {
+    }
+
+    guint Bits(guint n) {
+        guint value = 0;
+        while (n--)
+            value = value << 1 | Bit();
+        return value;
+    }
+    void Skip(guint n) {
+        pos += n;
+    }
+    // ue(v)
+    guint Ue() {
+        guint zeros = 0;
+        while (!Bit() && zeros < 31)
+            zeros++;
+        return (1u << zeros) - 1 + Bits(zeros);
+    }
+    // False if more bits were read than there are
+    bool ok() const {
+        return pos <= rbsp.size() * 8;
+    }
+
+  private:
+    guint Bit() {
+        size_t byte = pos / 8;
+        guint bit = byte < rbsp.size() ? ((guint8)rbsp[byte] >> (7 - pos % 8)) & 1 : 0;
+        pos++;
+        return bit;
+    }
+
+    const std::string &rbsp;
+    size_t pos = 0;
+};
+
+// Id of a VPS, SPS or PPS, -1 if it can't be read. Parameter sets of the same type and id
+// replace each other.
+int ParameterSetId(const guint8 *data, const Nal &nal, bool h265) {
+    size_t header_size = h265 ? 2 : 1;
+    std::string rbsp = ToRbsp(data + nal.header + header_size, nal.end - nal.header - header_size);
+    BitReader reader(rbsp);
+    guint id;
+    if (h265) {
+        guint type = (data[nal.header] >> 1) & 0x3f;
+        if (type == 32) {
+            id = reader.Bits(4); // vps_video_parameter_set_id
+        } else if (type == 33) {
+            reader.Skip(4); // sps_video_parameter_set_id
+            guint max_sub_layers_minus1 = reader.Bits(3);
+            reader.Skip(1);
+            // profile_tier_level(1, sps_max_sub_layers_minus1)
+            reader.Skip(88 + 8);
+            guint sub_layer_flags = reader.Bits(2 * max_sub_layers_minus1);
+            if (max_sub_layers_minus1 > 0)
+                reader.Skip(2 * (8 - max_sub_layers_minus1));
+            for (guint i = 0; i < max_sub_layers_minus1; i++) {
+                guint flags = (sub_layer_flags >> 2 * (max_sub_layers_minus1 - 1 - i)) & 3;
+                reader.Skip((flags & 2 ? 88 : 0) + (flags & 1 ? 8 : 0));
+            }
+            id = reader.Ue(); // sps_seq_parameter_set_id
+        } else {
+            id = reader.Ue(); // pps_pic_parameter_set_id
+        }
+    } else {
+        if ((data[nal.header] & 0x1f) == 7)
+            reader.Skip(24); // profile_idc, constraint flags, level_idc
+        id = reader.Ue(); // seq_parameter_set_id or pic_parameter_set_id
+    }
+    return reader.ok() && id <= 255 ? (int)id : -1;
+}
+
+// Calls f(type, payload, size) for every sei_message() of an SEI NAL unit, until it returns false
+template <typename F>
+void ForEachSeiMessage(const std::string &rbsp, F f) {
+    size_t p = 0, n = rbsp.size();
+    // sei_message() until the rbsp trailing bits
+    while (p < n && !(p + 1 == n && (guint8)rbsp[p] == 0x80)) {
+        guint type = 0, size = 0;
+        while (p < n && (guint8)rbsp[p] == 0xff)
+            type += 255, p++;
+        if (p == n)
+            break;
+        type += (guint8)rbsp[p++];
+        while (p < n && (guint8)rbsp[p] == 0xff)
+            size += 255, p++;
+        if (p == n)
+            break;
+        size += (guint8)rbsp[p++];
+        if (p + size > n || !f(type, rbsp.data() + p, size))
+            break;
+        p += size;
+    }
+}
+
+// Annotated regions SEI payloads since the last cancel, in stream order
+class AnnotatedRegionsHistory {
+  public:
+    explicit AnnotatedRegionsHistory(bool h265) : h265(h265) {
+    }
+
+    void Add(const guint8 *data, const Nal &nal) {
+        size_t header_size = h265 ? 2 : 1;
+        std::string rbsp = ToRbsp(data + nal.header + header_size, nal.end - nal.header - header_size);
+        ForEachSeiMessage(rbsp, [this](guint type, const char *payload, guint size) {
+            if (type == SEI_ANNOTATED_REGIONS) {
+                // ar_cancel_flag is the first bit of the payload
+                if (size > 0 && ((guint8)payload[0] & 0x80))
+                    payloads.clear();
+                else
+                    payloads.emplace_back(payload, size);
+            }
+            return true;
+        });
+    }
+
+    // One SEI NAL unit, with start code, that carries all payloads, empty if there are none
+    std::string Replay() const {
+        if (payloads.empty())
+            return "";
+        std::string rbsp;
+        for (const auto &payload : payloads) {
+            rbsp.push_back((char)SEI_ANNOTATED_REGIONS);
+            size_t size = payload.size();
+            for (; size >= 255; size -= 255)
+                rbsp.push_back((char)0xff);
+            rbsp.push_back((char)size);
+            rbsp += payload;
+        }
+        rbsp.push_back((char)0x80);
+        // prefix SEI with nuh_layer_id 0 and nuh_temporal_id_plus1 1 for H.265
+        std::string header = h265 ? std::string("\x4e\x01", 2) : std::string("\x06", 1);
+        return std::string("\x00\x00\x00\x01", 4) + header + ToEbsp(rbsp);
+    }
+
+  private:
+    bool h265;
+    std::vector<std::string> payloads;
+};
+
+} // namespace
+
+std::vector<std::string> SplitElementaryStream(const std::string &input, bool h265, guint num_segments,
+                                               const std::string &dir) {
+    GError *error = NULL;
+    GMappedFile *file = g_mapped_file_new(input.c_str(), FALSE, &error);
+    if (!file) {
+        std::string message = std::string("Can't read ") + input + ": " + error->message;
+        g_error_free(error);
+        throw std::runtime_error(message);
+    }
+    const guint8 *data = reinterpret_cast<const guint8 *>(g_mapped_file_get_contents(file));
+    size_t size = g_mapped_file_get_length(file);
+    size_t target = size / std::max(1u, num_segments);
+
+    std::vector<std::string> segments;
+    size_t segment_start = 0;
+    std::string segment_prefix;
+    auto write_segment = [&](size_t end) {
+        std::string path = dir + "/segment_" + std::to_string(segments.size()) + (h265 ? ".h265" : ".h264");
+        std::ofstream out(path, std::ios::binary);
+        size_t pos = segment_start;
+        // The access unit delimiter has to stay the first NAL unit of the access unit
+        Nal first;
+        if (!segment_prefix.empty() && NextNal(data, end, pos, first) && Classify(data, first, h265).kind == NAL_AUD) {
+            out.write(reinterpret_cast<const char *>(data + pos), first.end - pos);
+            pos = first.end;
+        }
+        out.write(segment_prefix.data(), segment_prefix.size());
+        out.write(reinterpret_cast<const char *>(data + pos), end - pos);
+        if (!out)
+            throw std::runtime_error("Can't write " + path);
+        segments.push_back(path);
+    };
+
+    // Latest parameter set of every NAL unit type and id, in VPS, SPS, PPS order. Segments may
+    // refer to any of them.
+    std::map<std::pair<guint8, int>, std::string> parameter_sets;
+    AnnotatedRegionsHistory history(h265);
+    std::vector<Nal> au_seis; // SEI of the current access unit, applied after its first slice
+    size_t au_start = size;   // start of the non-VCL NAL units before the next picture
+    Nal nal;
+    for (size_t pos = 0; NextNal(data, size, pos, nal); pos = nal.end) {
+        NalInfo info = Classify(data, nal, h265);
+        switch (info.kind) {
+        case NAL_PARAMETER_SET:
+            parameter_sets[{guint8(h265 ? data[nal.header] : data[nal.header] & 0x1f), ParameterSetId(data, nal, h265)}] =
+                std::string(reinterpret_cast<const char *>(data + nal.start), nal.end - nal.start);
+            // fall through
+        case NAL_AUD:
+        case NAL_OTHER:
+        case NAL_SEI:
+            if (au_start == size)
+                au_start = nal.start;
+            if (info.kind == NAL_SEI)
+                au_seis.push_back(nal);
+            break;
+        case NAL_SLICE:
+        case NAL_IDR:
+            if (info.first_slice) {
+                size_t picture_start = au_start != size ? au_start : nal.start;
+                if (info.kind == NAL_IDR && picture_start > segment_start && picture_start - segment_start >= target &&
+                    segments.size() + 1 < num_segments) {
+                    write_segment(picture_start);
+                    segment_start = picture_start;
+                    segment_prefix.clear();
+                    for (const auto &parameter_set : parameter_sets)
+                        segment_prefix += parameter_set.second;
+                    segment_prefix += history.Replay();
+                }
+                for (const Nal &sei : au_seis)
+                    history.Add(data, sei);
+                au_seis.clear();
+            }
+            au_start = size;
+            break;
+        }
+    }
+    write_segment(size);
+
+    g_mapped_file_unref(file);
+    return segments;
+}
+
+size_t AnnotatedRegionsSeiSize(const guint8 *data, size_t size, bool h265, guint &nal_units) {
+    size_t bytes = 0;
+    nal_units = 0;
+    size_t header_size = h265 ? 2 : 1;
+    Nal nal;
+    for (size_t pos = 0; NextNal(data, size, pos, nal); pos = nal.end) {
+        if (Classify(data, nal, h265).kind != NAL_SEI)
+            continue;
+        bool annotated_regions = false;
+        ForEachSeiMessage(ToRbsp(data + nal.header + header_size, nal.end - nal.header - header_size),
+                          [&](guint type, const char *, guint) {
+                              annotated_regions = type == SEI_ANNOTATED_REGIONS;
+                              return !annotated_regions;
+                          });
+        if (annotated_regions) {
+            bytes += nal.end - nal.start;
+            nal_units++;
+        }
+    }
+    return bytes;
+}
+
+void ConcatenateFiles(const std::vector<std::string> &inputs, const std::string &output) {
+    std::ofstream out(output, std::ios::binary);
+    for (const auto &input : inputs) {
+        std::ifstream in(input, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Can't read " + input);
+        out << in.rdbuf();
+    }
+    if (!out)
+        throw std::runtime_error("Can't write " + output);
+}
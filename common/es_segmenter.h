@@ -0,0 +1,27 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+// Splits an H.264 or H.265 Annex-B elementary stream at IDR access units into about
+// num_segments files of similar size in dir. Every segment after the first starts with the
+// last parameter sets and with one SEI NAL unit replaying the annotated regions SEI messages
+// since the last cancel, so a parser starting at the segment ends up with the same object and
+// label state as one that read the stream from the beginning. Returns the segment files in
+// stream order, throws std::runtime_error if the input can't be read or written.
+std::vector<std::string> SplitElementaryStream(const std::string &input, bool h265, guint num_segments,
+                                               const std::string &dir);
+
+// Bytes of the SEI NAL units with annotated regions messages in an Annex-B buffer, start
+// codes included. nal_units is set to their number.
+size_t AnnotatedRegionsSeiSize(const guint8 *data, size_t size, bool h265, guint &nal_units);
+
+// Appends the given files to output in order
+void ConcatenateFiles(const std::vector<std::string> &inputs, const std::string &output);
@@ -0,0 +1,120 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "face_attributes.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+static void append(char *text, size_t size, size_t &length, const char *format, va_list args) {
+    if (length + 1 >= size)
+        return;
+    int written = vsnprintf(text + length, size - length, format, args);
+    if (written > 0)
+        length = std::min(length + written, size - 1);
+}
+
+void FaceAttributes::Clear() {
+    text[0] = '\0';
+    length = 0;
+    stable_text[0] = '\0';
+    stable_length = 0;
+    head_angle_r = head_angle_p = head_angle_y = 0;
+}
+
+void FaceAttributes::Append(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    append(text, sizeof(text), length, format, args);
+    va_end(args);
+}
+
+void FaceAttributes::AppendStable(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    append(stable_text, sizeof(stable_text), stable_length, format, args);
+    va_end(args);
+}
+
+namespace {
+
+void Gender(const TensorView &tensor, FaceAttributes &attributes) {
+    if (tensor.size > 1) {
+        const char *gender = (tensor.data[1] > 0.5) ? "_M" : "_F";
+        attributes.Append("%s", gender);
+        attributes.AppendStable("%s", gender);
+    }
+}
+
+void Age(const TensorView &tensor, FaceAttributes &attributes) {
+    int age = (int)(tensor.data[0] * 100);
+    attributes.Append("%d", age);
+    // Decades, the estimate of a face moves by a few years from frame to frame
+    int decade = std::max(age, 0) / 10 * 10;
+    attributes.AppendStable("%d-%d", decade, decade + 9);
+}
+
+void Emotion(const TensorView &tensor, FaceAttributes &attributes) {
+    static const char *const emotionsDesc[] = {"neutral", "happy", "sad", "surprise", "anger"};
+    size_t index = std::max_element(tensor.data, tensor.data + tensor.size) - tensor.data;
+    if (index < sizeof(emotionsDesc) / sizeof(emotionsDesc[0]))
+        attributes.Append(" %s", emotionsDesc[index]);
+}
+
+template <float FaceAttributes::*Angle>
+void HeadAngle(const TensorView &tensor, FaceAttributes &attributes) {
+    attributes.*Angle = tensor.data[0];
+}
+
+struct LayerOutput {
+    const char *layer;
+    FacePostProcessor::Handler handler;
+};
+
+// Output layers of every supported model, in the order they appear in the label
+struct ModelOutputs {
+    const char *model;
+    LayerOutput outputs[3];
+};
+
+const ModelOutputs model_outputs[] = {
+    {"age-gender-recognition-retail-0013", {{"prob", Gender}, {"age_conv3", Age}}},
+    {"emotions-recognition-retail-0003", {{"prob_emotion", Emotion}}},
+    {"head-pose-estimation-adas-0001",
+     {{"angle_r_fc", HeadAngle<&FaceAttributes::head_angle_r>},
+      {"angle_p_fc", HeadAngle<&FaceAttributes::head_angle_p>},
+      {"angle_y_fc", HeadAngle<&FaceAttributes::head_angle_y>}}},
+};
+
+} // namespace
+
+bool FacePostProcessor::AddModel(const std::string &model_file) {
+    std::string model = model_file.substr(model_file.find_last_of('/') + 1);
+    model = model.substr(0, model.rfind(".xml"));
+    for (const ModelOutputs &entry : model_outputs) {
+        if (model != entry.model)
+            continue;
+        for (const LayerOutput &output : entry.outputs) {
+            if (!output.layer)
+                break;
+            int layer = layers.AddLayer(output.layer);
+            handlers.resize(layer + 1);
+            handlers[layer] = output.handler;
+        }
+        return true;
+    }
+    return false;
+}
+
+size_t FacePostProcessor::Process(GstVideoRegionOfInterestMeta *meta, FaceAttributes &attributes) {
+    attributes.Clear();
+    return layers.ForEachTensor(meta, [&](const TensorView &tensor) {
+        if (tensor.size > 0)
+            handlers[tensor.layer](tensor, attributes);
+    });
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "tensor_view.h"
+
+// Room for the attributes of all face classification models
+#define MAX_ATTRIBUTES_LENGTH 64
+
+// What the classification models found out about a face
+struct FaceAttributes {
+    char text[MAX_ATTRIBUTES_LENGTH]; // label suffix, e.g. "_M35 happy"
+    size_t length;
+    // Same with the age as a range and without the emotion, e.g. "_M30-39". It changes seldom
+    // enough for the label table of the AR SEI.
+    char stable_text[MAX_ATTRIBUTES_LENGTH];
+    size_t stable_length;
+    float head_angle_r;
+    float head_angle_p;
+    float head_angle_y;
+
+    void Clear();
+    // Appends formatted text as far as it fits
+    void Append(const char *format, ...);
+    // Same for stable_text
+    void AppendStable(const char *format, ...);
+};
+
+// Turns the output tensors of the face classification models into FaceAttributes. The
+// handlers of the models in use are put into a table indexed by layer ID when the pipeline
+// is built, so interpreting a tensor is one indirect call, without looking at its name.
+class FacePostProcessor {
+  public:
+    // Adds the outputs of a model by its file name, e.g. "age-gender-recognition-retail-0013.xml".
+    // Returns false if there is no handler for the model. Call before the pipeline starts.
+    bool AddModel(const std::string &model_file);
+
+    // Clears attributes and fills them from the tensors of a region. Returns the number of
+    // tensors the region has, 0 if it wasn't classified.
+    size_t Process(GstVideoRegionOfInterestMeta *meta, FaceAttributes &attributes);
+
+    typedef void (*Handler)(const TensorView &tensor, FaceAttributes &attributes);
+
+  private:
+    LayerTable layers;
+    std::vector<Handler> handlers; // by layer ID
+};
@@ -0,0 +1,389 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "job_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <glib/gstdio.h>
+#include <glob.h>
+#include <gst/video/video.h>
+#include <poll.h>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// How often the spool directory is scanned for new jobs
+#define SPOOL_POLL_MS 500
+
+ReusablePipeline::ReusablePipeline(GstElement *pipeline) : pipeline(pipeline) {
+    src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    if (!src || !sink)
+        throw std::runtime_error("Reusable pipeline needs elements named 'src' and 'sink'");
+    bus = gst_element_get_bus(pipeline);
+
+    // A parser that pulls from src would not take it back after src was restarted, a queue
+    // behind src keeps the rest of the pipeline in push mode
+    GstPad *src_pad = gst_element_get_static_pad(src, "src");
+    GstPad *peer = gst_pad_get_peer(src_pad);
+    if (!peer) {
+        gst_object_unref(src_pad);
+        throw std::runtime_error("Reusable pipeline needs 'src' linked");
+    }
+    GstElement *next = gst_pad_get_parent_element(peer);
+    if (!next || g_strcmp0(G_OBJECT_TYPE_NAME(next), "GstQueue") != 0) {
+        GstElement *queue = gst_element_factory_make("queue", NULL);
+        gst_bin_add(GST_BIN(pipeline), queue);
+        GstPad *queue_sink = gst_element_get_static_pad(queue, "sink");
+        GstPad *queue_src = gst_element_get_static_pad(queue, "src");
+        gst_pad_unlink(src_pad, peer);
+        if (gst_pad_link(src_pad, queue_sink) != GST_PAD_LINK_OK || gst_pad_link(queue_src, peer) != GST_PAD_LINK_OK)
+            throw std::runtime_error("Failed to insert a queue behind 'src'");
+        gst_object_unref(queue_sink);
+        gst_object_unref(queue_src);
+    }
+    if (next)
+        gst_object_unref(next);
+    gst_object_unref(peer);
+    gst_object_unref(src_pad);
+
+    // The end of a job is signalled by EOS reaching the sink. It is dropped there so that the
+    // pipeline itself never goes EOS and can take the next job.
+    GstPad *pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eos_probe, this, NULL);
+    gst_object_unref(pad);
+}
+
+ReusablePipeline::~ReusablePipeline() {
+    // src and sink are locked and do not follow the pipeline state
+    gst_element_set_state(src, GST_STATE_NULL);
+    gst_element_set_state(sink, GST_STATE_NULL);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+}
+
+GstPadProbeReturn ReusablePipeline::eos_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    ReusablePipeline *self = static_cast<ReusablePipeline *>(user_data);
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+        return GST_PAD_PROBE_OK;
+    gst_element_post_message(self->pipeline, gst_message_new_application(GST_OBJECT(self->sink),
+                                                                         gst_structure_new_empty("job-done")));
+    return GST_PAD_PROBE_DROP;
+}
+
+bool ReusablePipeline::Run(const std::string &input, const std::string &output, std::string &error) {
+    g_object_set(src, "location", input.c_str(), NULL);
+    g_object_set(sink, "location", output.c_str(), NULL);
+
+    if (!started) {
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            error = "Failed to start the pipeline";
+            is_broken = true;
+            return false;
+        }
+        gst_element_set_locked_state(src, TRUE);
+        gst_element_set_locked_state(sink, TRUE);
+        started = true;
+    } else {
+        // Reset EOS and the encoder state left over from the previous job
+        GstPad *pad = gst_element_get_static_pad(src, "src");
+        GstPad *peer = gst_pad_get_peer(pad);
+        gst_pad_send_event(peer, gst_event_new_flush_start());
+        gst_pad_send_event(peer, gst_event_new_flush_stop(TRUE));
+        gst_object_unref(peer);
+        gst_object_unref(pad);
+
+        // Start the new output with an IDR, the encoder resets its AR SEI state there
+        pad = gst_element_get_static_pad(sink, "sink");
+        peer = gst_pad_get_peer(pad);
+        gst_pad_send_event(peer, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        gst_object_unref(peer);
+        gst_object_unref(pad);
+
+        if (gst_element_set_state(sink, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE ||
+            gst_element_set_state(src, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            error = "Failed to open " + input + " or " + output;
+            is_broken = true;
+            return false;
+        }
+    }
+
+    bool ok = true;
+    GstMessage *msg =
+        gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_APPLICATION));
+    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        GError *err = NULL;
+        gst_message_parse_error(msg, &err, NULL);
+        error = std::string("ERROR from element ") + GST_OBJECT_NAME(msg->src) + ": " + err->message;
+        g_error_free(err);
+        is_broken = true;
+        ok = false;
+    }
+    if (msg)
+        gst_message_unref(msg);
+
+    // Closes the output file, the elements in between keep running
+    gst_element_set_state(src, GST_STATE_NULL);
+    gst_element_set_state(sink, GST_STATE_NULL);
+    return ok;
+}
+
+static bool parse_job(const std::string &line, Job &job) {
+    std::istringstream fields(line);
+    std::string field;
+    job.clear();
+    while (fields >> field) {
+        auto pos = field.find('=');
+        if (pos == std::string::npos)
+            job[field] = "";
+        else
+            job[field.substr(0, pos)] = field.substr(pos + 1);
+    }
+    return !job.empty();
+}
+
+static int open_socket(const gchar *socket_path) {
+    struct sockaddr_un addr = {};
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        throw std::runtime_error(std::string("Socket path too long: ") + socket_path);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+        throw std::runtime_error(std::string("Can't listen on ") + socket_path);
+    return fd;
+}
+
+struct JobStats {
+    guint64 jobs = 0;
+    guint64 failed = 0;
+    gint64 start = g_get_monotonic_time();
+
+    void Print() const {
+        double minutes = (g_get_monotonic_time() - start) / 60e6;
+        g_print("Served %" G_GUINT64_FORMAT " jobs (%" G_GUINT64_FORMAT " failed), %.1f jobs per minute\n", jobs,
+                failed, minutes > 0 ? jobs / minutes : 0.0);
+    }
+};
+
+static bool run_job(const JobHandler &handler, const std::string &line, std::string &result, JobStats &stats) {
+    Job job;
+    if (!parse_job(line, job)) {
+        result = "ERROR empty job";
+        return false;
+    }
+    gint64 start = g_get_monotonic_time();
+    std::string error;
+    bool ok = handler(job, error);
+    stats.jobs++;
+    if (!ok)
+        stats.failed++;
+    result = ok ? "OK " + std::to_string((g_get_monotonic_time() - start) / 1000) : "ERROR " + error;
+    g_print("[job %" G_GUINT64_FORMAT "] %s: %s\n", stats.jobs, line.c_str(), result.c_str());
+    return ok;
+}
+
+// Serves one client connection, returns false if the client asked the server to quit
+static bool serve_client(int fd, const JobHandler &handler, JobStats &stats) {
+    std::string pending;
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        pending.append(chunk, n);
+        size_t eol;
+        while ((eol = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            if (line == "quit")
+                return false;
+            std::string result;
+            run_job(handler, line, result, stats);
+            result += "\n";
+            if (write(fd, result.c_str(), result.size()) < 0)
+                return true;
+        }
+    }
+    return true;
+}
+
+// Runs all pending jobs of the spool directory in name order, returns false on a "quit" job
+static bool serve_spool(const gchar *spool_dir, const JobHandler &handler, JobStats &stats) {
+    GDir *dir = g_dir_open(spool_dir, 0, NULL);
+    if (!dir)
+        return true;
+    std::vector<std::string> names;
+    while (const gchar *name = g_dir_read_name(dir))
+        if (g_str_has_suffix(name, ".job"))
+            names.push_back(name);
+    g_dir_close(dir);
+    std::sort(names.begin(), names.end());
+
+    for (const auto &name : names) {
+        std::string base = std::string(spool_dir) + "/" + name.substr(0, name.size() - 4);
+        std::string running = base + ".running";
+        // Claim the job, another server may be watching the same directory
+        if (rename((base + ".job").c_str(), running.c_str()) != 0)
+            continue;
+        std::string line;
+        std::ifstream file(running);
+        std::getline(file, line);
+        file.close();
+        if (line == "quit") {
+            remove(running.c_str());
+            return false;
+        }
+        std::string result;
+        bool ok = run_job(handler, line, result, stats);
+        std::ofstream(running, std::ios::app) << result << "\n";
+        rename(running.c_str(), (base + (ok ? ".done" : ".failed")).c_str());
+    }
+    return true;
+}
+
+std::vector<std::string> ExpandInputList(const gchar *inputs) {
+    std::vector<std::string> files;
+    gchar **items = g_strsplit(inputs, ",", -1);
+    for (gchar **item = items; *item; item++) {
+        if (!**item)
+            continue;
+        glob_t matches;
+        // Names without wildcards are kept even if they don't exist, the pipeline reports the error
+        if (glob(*item, GLOB_NOCHECK, NULL, &matches) == 0)
+            files.insert(files.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        globfree(&matches);
+    }
+    g_strfreev(items);
+    return files;
+}
+
+std::string SharedInstanceOptions(gint workers, const gchar *device) {
+    if (workers <= 1)
+        return "";
+    std::string options = " nireq=" + std::to_string(2 * workers);
+    if (g_strcmp0(device, "CPU") == 0)
+        options += " ie-config=CPU_THROUGHPUT_STREAMS=" + std::to_string(workers);
+    return options;
+}
+
+int RunJobPool(const std::vector<Job> &jobs, guint workers, const JobHandlerFactory &make_handler) {
+    if (workers == 0)
+        workers = g_get_num_processors();
+    workers = std::max(1u, std::min<guint>(workers, jobs.size()));
+
+    // Longest clips first, so a long clip picked up last does not keep one worker busy alone
+    std::vector<std::pair<goffset, const Job *>> order;
+    for (const auto &job : jobs) {
+        GStatBuf st;
+        auto input = job.find("input");
+        order.emplace_back(input != job.end() && g_stat(input->second.c_str(), &st) == 0 ? st.st_size : 0, &job);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [](const std::pair<goffset, const Job *> &a, const std::pair<goffset, const Job *> &b) {
+                         return a.first > b.first;
+                     });
+
+    // Idle workers take the next job from the shared queue
+    std::atomic<size_t> next(0);
+    std::mutex stats_mutex;
+    JobStats stats;
+    std::vector<guint64> worker_jobs(workers, 0);
+    std::vector<gint64> worker_busy(workers, 0);
+
+    auto worker = [&](guint id) {
+        JobHandler handler = make_handler();
+        size_t i;
+        while ((i = next++) < order.size()) {
+            const Job &job = *order[i].second;
+            std::string error;
+            gint64 start = g_get_monotonic_time();
+            bool ok = handler(job, error);
+            gint64 elapsed = g_get_monotonic_time() - start;
+
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats.jobs++;
+            if (!ok)
+                stats.failed++;
+            worker_jobs[id]++;
+            worker_busy[id] += elapsed;
+            std::string input = job.count("input") ? job.at("input") : "";
+            g_print("[job %" G_GUINT64_FORMAT "/%zu, worker %u] %s: %s\n", stats.jobs, jobs.size(), id,
+                    input.c_str(), ok ? ("OK " + std::to_string(elapsed / 1000)).c_str() : ("ERROR " + error).c_str());
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (guint id = 1; id < workers; id++)
+        threads.emplace_back(worker, id);
+    worker(0);
+    for (auto &thread : threads)
+        thread.join();
+
+    stats.Print();
+    if (workers > 1) {
+        double wall = (g_get_monotonic_time() - stats.start) / 1e6;
+        gint64 busy = 0;
+        for (guint id = 0; id < workers; id++) {
+            g_print("  worker %u: %" G_GUINT64_FORMAT " jobs, busy %.1f s\n", id, worker_jobs[id], worker_busy[id] / 1e6);
+            busy += worker_busy[id];
+        }
+        g_print("  %u workers, %.1f s wall time, %.2fx speedup over running the jobs one by one\n", workers, wall,
+                wall > 0 ? busy / 1e6 / wall : 0.0);
+    }
+    return stats.failed ? -1 : 0;
+}
+
+int RunJobList(const std::vector<Job> &jobs, const JobHandler &handler) {
+    return RunJobPool(jobs, 1, [&]() { return handler; });
+}
+
+int RunJobServer(const gchar *socket_path, const gchar *spool_dir, const JobHandler &handler) {
+    int listen_fd = socket_path ? open_socket(socket_path) : -1;
+    JobStats stats;
+    bool running = true;
+    g_print("Waiting for jobs%s%s%s%s\n", socket_path ? " on " : "", socket_path ? socket_path : "",
+            spool_dir ? " in " : "", spool_dir ? spool_dir : "");
+
+    while (running) {
+        if (spool_dir)
+            running = serve_spool(spool_dir, handler, stats);
+        if (!running)
+            break;
+        if (listen_fd < 0) {
+            g_usleep(SPOOL_POLL_MS * 1000);
+            continue;
+        }
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, spool_dir ? SPOOL_POLL_MS : -1) > 0) {
+            int client = accept(listen_fd, NULL, NULL);
+            if (client >= 0) {
+                running = serve_client(client, handler, stats);
+                close(client);
+            }
+        }
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+    stats.Print();
+    return 0;
+}
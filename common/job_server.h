@@ -0,0 +1,71 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <gst/gst.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Pipeline that is kept alive between jobs. Only the elements named "src" (filesrc) and "sink"
+// (filesink) are restarted with new locations, everything in between, including the loaded
+// inference models, stays in PLAYING state. Every job after the first starts with a flush and
+// a forced key unit, so each output file begins with an IDR. A queue is inserted behind "src"
+// if the pipeline has none there.
+class ReusablePipeline {
+  public:
+    // Takes ownership of pipeline
+    explicit ReusablePipeline(GstElement *pipeline);
+    ~ReusablePipeline();
+
+    // Processes input into output, returns FALSE and sets error on failure. After a failure
+    // the pipeline is broken and has to be recreated.
+    bool Run(const std::string &input, const std::string &output, std::string &error);
+
+    bool broken() const {
+        return is_broken;
+    }
+
+  private:
+    static GstPadProbeReturn eos_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    GstElement *pipeline;
+    GstElement *src;
+    GstElement *sink;
+    GstBus *bus;
+    bool started = false;
+    bool is_broken = false;
+};
+
+// A job is a set of key=value pairs, e.g. "input=a.h264 codec=h265 output=out/a.h265"
+typedef std::map<std::string, std::string> Job;
+typedef std::function<bool(const Job &job, std::string &error)> JobHandler;
+
+// Expands a ',' separated list of files and glob patterns, in the given order
+std::vector<std::string> ExpandInputList(const gchar *inputs);
+
+typedef std::function<JobHandler()> JobHandlerFactory;
+
+// gvadetect/gvainference options for a model instance (model-instance-id) that is shared by
+// the pipelines of several workers: one infer request per worker in flight and, on CPU, one
+// throughput stream per worker
+std::string SharedInstanceOptions(gint workers, const gchar *device);
+
+// Runs the given jobs one after another, returns the process exit code
+int RunJobList(const std::vector<Job> &jobs, const JobHandler &handler);
+
+// Runs the given jobs on a pool of worker threads, 0 workers means one per core. Every worker
+// gets its own handler from make_handler, and with it its own pipelines, and takes the next job
+// from the shared queue when it is idle. Prints the aggregate throughput at the end.
+int RunJobPool(const std::vector<Job> &jobs, guint workers, const JobHandlerFactory &make_handler);
+
+// Serves jobs one after another until a "quit" job arrives. Jobs are read one per line from
+// clients of the UNIX socket socket_path, which get "OK <elapsed ms>" or "ERROR <message>" back,
+// and from "*.job" files in spool_dir, which are renamed to ".done" or ".failed". Either of
+// socket_path and spool_dir may be NULL. Returns the process exit code.
+int RunJobServer(const gchar *socket_path, const gchar *spool_dir, const JobHandler &handler);
@@ -0,0 +1,410 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "metrics_server.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <gst/video/gstvideometa.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "es_segmenter.h"
+
+// How often the server thread checks whether it has to stop
+#define SERVER_POLL_MS 200
+// A client that hasn't sent its request by then is dropped
+#define REQUEST_TIMEOUT_MS 1000
+
+namespace {
+
+// Slot of the calling thread, threads get consecutive slots
+int thread_slot(int slots) {
+    static std::atomic<int> next_slot(0);
+    thread_local int slot = next_slot++;
+    return slot % slots;
+}
+
+// Inference latency in microseconds and objects per frame
+const std::vector<guint64> LATENCY_BOUNDS_US = {1000,   2500,   5000,    10000,   25000,  50000,
+                                                100000, 250000, 500000, 1000000, 2500000};
+const std::vector<guint64> OBJECT_BOUNDS = {0, 1, 2, 4, 8, 16, 32, 64};
+
+int listen_unix(const std::string &path) {
+    struct sockaddr_un addr = {};
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+        throw std::runtime_error("Can't listen on " + path);
+    return fd;
+}
+
+int listen_tcp(const std::string &address) {
+    size_t colon = address.rfind(':');
+    std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+    int port = atoi(address.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        throw std::runtime_error("Invalid metrics address " + address);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0)
+        throw std::runtime_error("Can't listen on " + address);
+    return fd;
+}
+
+// Reads the request header, returns the request path or "" on errors
+std::string read_request(int fd) {
+    std::string request;
+    char chunk[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0)
+            return "";
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+            break;
+        request.append(chunk, n);
+    }
+    // GET /metrics HTTP/1.1
+    size_t start = request.find(' ');
+    size_t end = start == std::string::npos ? start : request.find(' ', start + 1);
+    if (request.compare(0, 4, "GET ") != 0 || end == std::string::npos)
+        return "";
+    return request.substr(start + 1, end - start - 1);
+}
+
+void write_all(int fd, const std::string &data) {
+    for (size_t written = 0; written < data.size();) {
+        // No SIGPIPE if the scraper went away
+        ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        written += n;
+    }
+}
+
+std::string label(const char *name, const std::string &value) {
+    return std::string(name) + "=\"" + value + "\"";
+}
+
+void append_value(std::string &out, const std::string &name, const std::string &labels, guint64 value) {
+    out += name + "{" + labels + "} " + std::to_string(value) + "\n";
+}
+
+void append_help(std::string &out, const char *name, const char *type, const char *help) {
+    out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+}
+
+// Slot of a frame in the pending table, timestamps usually are multiples of the frame duration
+size_t pending_slot(GstClockTime pts, size_t slots) {
+    return (size_t)((pts * 0x9e3779b97f4a7c15ull) >> 32) % slots;
+}
+
+} // namespace
+
+void ShardedCounter::Add(guint64 value) {
+    slots[thread_slot(SLOTS)].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+guint64 ShardedCounter::Value() const {
+    guint64 value = 0;
+    for (const Slot &slot : slots)
+        value += slot.value.load(std::memory_order_relaxed);
+    return value;
+}
+
+ShardedHistogram::ShardedHistogram(const std::vector<guint64> &bounds, double unit)
+    : bounds(bounds), unit(unit), buckets(new ShardedCounter[bounds.size() + 1]) {
+}
+
+void ShardedHistogram::Observe(guint64 value) {
+    size_t bucket = 0;
+    while (bucket < bounds.size() && value > bounds[bucket])
+        bucket++;
+    buckets[bucket].Add(1);
+    sum.Add(value);
+}
+
+void ShardedHistogram::Render(std::string &out, const std::string &name, const std::string &labels) const {
+    guint64 count = 0;
+    char bound[32];
+    for (size_t i = 0; i <= bounds.size(); i++) {
+        count += buckets[i].Value();
+        if (i < bounds.size())
+            snprintf(bound, sizeof(bound), "%g", bounds[i] / unit);
+        append_value(out, name + "_bucket", labels + "," + label("le", i < bounds.size() ? bound : "+Inf"), count);
+    }
+    snprintf(bound, sizeof(bound), "%g", sum.Value() / unit);
+    out += name + "_sum{" + labels + "} " + bound + "\n";
+    append_value(out, name + "_count", labels, count);
+}
+
+MetricsServer::Stream::Stream() : objects_per_frame(OBJECT_BOUNDS, 1) {
+}
+
+MetricsServer::Inference::Inference() : latency(LATENCY_BOUNDS_US, 1e6) {
+}
+
+MetricsServer::MetricsServer(const std::string &address) : address(address) {
+    listen_fd = address.find('/') != std::string::npos ? listen_unix(address) : listen_tcp(address);
+    server = std::thread(&MetricsServer::Serve, this);
+    g_print("Serving metrics on %s\n", address.c_str());
+}
+
+MetricsServer::~MetricsServer() {
+    stopping = true;
+    server.join();
+    close(listen_fd);
+    if (address.find('/') != std::string::npos)
+        unlink(address.c_str());
+}
+
+void MetricsServer::Serve() {
+    while (!stopping) {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, SERVER_POLL_MS) <= 0)
+            continue;
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0)
+            continue;
+        std::string path = read_request(client);
+        if (path == "/metrics" || path == "/") {
+            std::string body = Render();
+            write_all(client, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                  std::to_string(body.size()) + "\r\n\r\n" + body);
+        } else {
+            write_all(client, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        }
+        close(client);
+    }
+}
+
+// Adds a buffer probe to a static pad of the named element, returns false if there is none
+static bool add_probe(GstElement *pipeline, const std::string &element_name, const char *pad_name,
+                      GstPadProbeCallback callback, gpointer user_data) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name.c_str());
+    if (!element)
+        return false;
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data, NULL);
+        gst_object_unref(pad);
+    }
+    gst_object_unref(element);
+    return pad != NULL;
+}
+
+void MetricsServer::Attach(GstElement *pipeline, const std::vector<MetricsTaps> &streams) {
+    std::lock_guard<std::mutex> lock(attach_mutex);
+    pipelines.emplace_back(new Pipeline());
+    Pipeline *metrics = pipelines.back().get();
+    metrics->index = (int)pipelines.size() - 1;
+
+    for (const MetricsTaps &taps : streams) {
+        metrics->streams.emplace_back(new Stream());
+        Stream *stream = metrics->streams.back().get();
+        stream->name = taps.encoder;
+        stream->h265 = taps.h265;
+        add_probe(pipeline, taps.input, "sink", FrameIn, stream);
+        add_probe(pipeline, taps.encoder, "sink", EncoderIn, stream);
+        add_probe(pipeline, taps.encoder, "src", EncoderOut, stream);
+        for (const std::string &name : taps.inference) {
+            metrics->inference.emplace_back(new Inference());
+            Inference *inference = metrics->inference.back().get();
+            inference->name = name;
+            add_probe(pipeline, name, "sink", InferenceIn, inference);
+            add_probe(pipeline, name, "src", InferenceOut, inference);
+        }
+    }
+
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+        if (strcmp(G_OBJECT_TYPE_NAME(element), "GstQueue") == 0) {
+            metrics->queues.emplace_back(new Queue());
+            Queue *queue = metrics->queues.back().get();
+            gchar *name = gst_element_get_name(element);
+            queue->name = name;
+            g_free(name);
+            queue->queue = element;
+            GstPad *pad = gst_element_get_static_pad(element, "src");
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, QueueOut, queue, NULL);
+            gst_object_unref(pad);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+
+    // QoS messages are posted from the streaming thread that dropped the frame
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gst_bus_enable_sync_message_emission(bus);
+    g_signal_connect(bus, "sync-message::qos", G_CALLBACK(OnQos), metrics);
+    gst_object_unref(bus);
+}
+
+GstPadProbeReturn MetricsServer::FrameIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    (void)info;
+    static_cast<Stream *>(user_data)->frames_in.Add(1);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn MetricsServer::EncoderIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer)
+        return GST_PAD_PROBE_OK;
+    guint64 objects = 0;
+    gpointer state = NULL;
+    while (gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))
+        objects++;
+    static_cast<Stream *>(user_data)->objects_per_frame.Observe(objects);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn MetricsServer::EncoderOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Stream *stream = static_cast<Stream *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+        return GST_PAD_PROBE_OK;
+    guint nal_units;
+    size_t sei_bytes = AnnotatedRegionsSeiSize(map.data, map.size, stream->h265, nal_units);
+    stream->frames_out.Add(1);
+    stream->encoded_bytes.Add(map.size);
+    stream->sei_bytes.Add(sei_bytes);
+    stream->sei_nal_units.Add(nal_units);
+    gst_buffer_unmap(buffer, &map);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn MetricsServer::InferenceIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Inference *inference = static_cast<Inference *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    Inference::Pending &slot = inference->pending[pending_slot(pts, Inference::PENDING)];
+    // Invalidate the slot while it is rewritten
+    slot.pts.store(GST_CLOCK_TIME_NONE, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.entered.store(g_get_monotonic_time(), std::memory_order_relaxed);
+    slot.pts.store(pts, std::memory_order_release);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn MetricsServer::InferenceOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Inference *inference = static_cast<Inference *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    Inference::Pending &slot = inference->pending[pending_slot(pts, Inference::PENDING)];
+    if (slot.pts.load(std::memory_order_acquire) != pts)
+        return GST_PAD_PROBE_OK;
+    gint64 entered = slot.entered.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Rewritten by a later frame in the meantime
+    if (slot.pts.load(std::memory_order_relaxed) != pts)
+        return GST_PAD_PROBE_OK;
+    inference->latency.Observe(std::max<gint64>(g_get_monotonic_time() - entered, 0));
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn MetricsServer::QueueOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    (void)info;
+    Queue *queue = static_cast<Queue *>(user_data);
+    guint level = 0;
+    g_object_get(queue->queue, "current-level-buffers", &level, NULL);
+    queue->level.store(level, std::memory_order_relaxed);
+    return GST_PAD_PROBE_OK;
+}
+
+void MetricsServer::OnQos(GstBus *bus, GstMessage *message, gpointer user_data) {
+    (void)bus;
+    Pipeline *metrics = static_cast<Pipeline *>(user_data);
+    GstFormat format;
+    guint64 processed, dropped;
+    gst_message_parse_qos_stats(message, &format, &processed, &dropped);
+    if (format != GST_FORMAT_BUFFERS || dropped == (guint64)-1)
+        return;
+    std::lock_guard<std::mutex> lock(metrics->qos_mutex);
+    metrics->dropped[GST_OBJECT_NAME(message->src)] = dropped;
+}
+
+std::string MetricsServer::Render() const {
+    std::lock_guard<std::mutex> lock(attach_mutex);
+    std::string out;
+    auto streams = [&](const char *name, const char *type, const char *help, const ShardedCounter Stream::*counter) {
+        append_help(out, name, type, help);
+        for (const auto &pipeline : pipelines)
+            for (const auto &stream : pipeline->streams)
+                append_value(out, name,
+                             label("pipeline", std::to_string(pipeline->index)) + "," + label("stream", stream->name),
+                             (stream.get()->*counter).Value());
+    };
+    streams("arsei_frames_in_total", "counter", "Frames entering the stream", &Stream::frames_in);
+    streams("arsei_frames_out_total", "counter", "Encoded frames", &Stream::frames_out);
+    streams("arsei_encoded_bytes_total", "counter", "Bytes out of the encoder, 8 * rate() is the bitrate",
+            &Stream::encoded_bytes);
+    streams("arsei_sei_bytes_total", "counter", "Bytes of the annotated regions SEI NAL units", &Stream::sei_bytes);
+    streams("arsei_sei_nal_units_total", "counter", "Annotated regions SEI NAL units", &Stream::sei_nal_units);
+
+    append_help(out, "arsei_objects_per_frame", "histogram", "Regions of interest per frame at the encoder");
+    for (const auto &pipeline : pipelines)
+        for (const auto &stream : pipeline->streams)
+            stream->objects_per_frame.Render(out, "arsei_objects_per_frame",
+                                             label("pipeline", std::to_string(pipeline->index)) + "," +
+                                                 label("stream", stream->name));
+
+    append_help(out, "arsei_inference_latency_seconds", "histogram", "Time frames spend in an inference element");
+    for (const auto &pipeline : pipelines)
+        for (const auto &inference : pipeline->inference)
+            inference->latency.Render(out, "arsei_inference_latency_seconds",
+                                      label("pipeline", std::to_string(pipeline->index)) + "," +
+                                          label("element", inference->name));
+
+    append_help(out, "arsei_queue_level_buffers", "gauge", "Buffers in a queue when it last pushed one");
+    for (const auto &pipeline : pipelines)
+        for (const auto &queue : pipeline->queues)
+            append_value(out, "arsei_queue_level_buffers",
+                         label("pipeline", std::to_string(pipeline->index)) + "," + label("queue", queue->name),
+                         queue->level.load(std::memory_order_relaxed));
+
+    append_help(out, "arsei_frames_dropped_total", "counter", "Frames dropped according to QoS messages");
+    for (const auto &pipeline : pipelines) {
+        guint64 dropped = 0;
+        {
+            std::lock_guard<std::mutex> qos_lock(pipeline->qos_mutex);
+            for (const auto &element : pipeline->dropped)
+                dropped += element.second;
+        }
+        append_value(out, "arsei_frames_dropped_total", label("pipeline", std::to_string(pipeline->index)), dropped);
+    }
+    return out;
+}
@@ -0,0 +1,138 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counter the streaming threads add to without locks and without sharing cache lines: every
+// thread adds to its own slot, reading sums the slots
+class ShardedCounter {
+  public:
+    void Add(guint64 value);
+    guint64 Value() const;
+
+  private:
+    static const int SLOTS = 16;
+    // A cache line apart, whatever the alignment of the counter
+    struct Slot {
+        std::atomic<guint64> value{0};
+        char padding[64 - sizeof(std::atomic<guint64>)];
+    };
+    Slot slots[SLOTS];
+};
+
+// Histogram of integer values with fixed bucket bounds, rendered in units of unit
+// (1000000 for microseconds as seconds)
+class ShardedHistogram {
+  public:
+    ShardedHistogram(const std::vector<guint64> &bounds, double unit);
+    void Observe(guint64 value);
+
+    // Appends the Prometheus text lines of the histogram, labels without braces
+    void Render(std::string &out, const std::string &name, const std::string &labels) const;
+
+  private:
+    std::vector<guint64> bounds;
+    double unit;
+    std::unique_ptr<ShardedCounter[]> buckets; // one more than bounds, for +Inf
+    ShardedCounter sum;
+};
+
+// Elements of one stream of a pipeline the metrics are taken from
+struct MetricsTaps {
+    // Frames entering the stream are counted on the sink pad of this element
+    std::string input;
+    // Inference elements, their latency is measured from sink to src pad
+    std::vector<std::string> inference;
+    // Frames leaving, objects per frame, encoded bytes and AR SEI bytes are taken from the
+    // encoder, which has to output Annex-B
+    std::string encoder;
+    bool h265;
+};
+
+// Serves the counters of the attached pipelines in the Prometheus text format over HTTP, on
+// a TCP port of the loopback interface or on a UNIX socket. The counters are updated by pad
+// probes on the streaming threads without locks, a scrape only reads them.
+class MetricsServer {
+  public:
+    // address is "[host:]port", host defaults to 127.0.0.1, or the path of a UNIX socket.
+    // Throws std::runtime_error if it can't listen.
+    explicit MetricsServer(const std::string &address);
+    ~MetricsServer();
+
+    // Installs the probes of the given streams of the pipeline, which has to be destroyed
+    // before this object. Queue levels and frames dropped according to QoS messages are
+    // taken from all elements of the pipeline.
+    void Attach(GstElement *pipeline, const std::vector<MetricsTaps> &streams);
+
+    // The metrics in the Prometheus text exposition format
+    std::string Render() const;
+
+  private:
+    struct Pipeline;
+    struct Stream {
+        std::string name;
+        bool h265;
+        ShardedCounter frames_in;
+        ShardedCounter frames_out;
+        ShardedCounter encoded_bytes;
+        ShardedCounter sei_bytes;
+        ShardedCounter sei_nal_units;
+        ShardedHistogram objects_per_frame;
+        Stream();
+    };
+    struct Inference {
+        static const int PENDING = 256;
+        // Entry time of the frames in the element by timestamp, written by the sink pad
+        // thread and read by the src pad thread like a seqlock
+        struct Pending {
+            std::atomic<GstClockTime> pts{GST_CLOCK_TIME_NONE};
+            std::atomic<gint64> entered{0};
+        };
+        std::string name;
+        Pending pending[PENDING];
+        ShardedHistogram latency;
+        Inference();
+    };
+    struct Queue {
+        std::string name;
+        GstElement *queue; // not owned
+        std::atomic<guint> level{0};
+    };
+    struct Pipeline {
+        int index;
+        std::vector<std::unique_ptr<Stream>> streams;
+        std::vector<std::unique_ptr<Inference>> inference;
+        std::vector<std::unique_ptr<Queue>> queues;
+        // Frames dropped so far by every element posting QoS messages, which are rare
+        mutable std::mutex qos_mutex;
+        std::map<std::string, guint64> dropped;
+    };
+
+    static GstPadProbeReturn FrameIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn EncoderIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn EncoderOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn InferenceIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn InferenceOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn QueueOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static void OnQos(GstBus *bus, GstMessage *message, gpointer user_data);
+    void Serve();
+
+    std::string address;
+    int listen_fd;
+    std::atomic<bool> stopping{false};
+    std::thread server;
+    mutable std::mutex attach_mutex; // pipelines are attached while others are scraped
+    std::vector<std::unique_ptr<Pipeline>> pipelines;
+};
@@ -0,0 +1,227 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "model_index.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <glib.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MODEL_INDEX_VERSION "ARSEI-MODEL-INDEX 2"
+
+static std::string to_upper_case(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+    return str;
+}
+
+static bool stat_mtime(const std::string &path, int64_t &mtime, bool &is_dir) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    is_dir = S_ISDIR(st.st_mode);
+    return true;
+}
+
+static const ModelEntry *find_precision(const ModelPrecisions &precisions, const std::string &precision) {
+    for (const auto &entry : precisions)
+        if (entry.first == precision)
+            return &entry.second;
+    return NULL;
+}
+
+// Cache file name depends on the search directories, so different MODELS_PATH values do not collide
+static std::string cache_path(const std::vector<std::string> &search_dirs) {
+    if (const char *path = getenv("ARSEI_MODEL_INDEX"))
+        return path;
+    std::string key;
+    for (const auto &dir : search_dirs)
+        key += (dir.empty() || dir.back() == '/' ? dir : dir + "/") + ":";
+    char name[64];
+    snprintf(name, sizeof(name), "model_index_%016zx.txt", std::hash<std::string>()(key));
+    gchar *path = g_build_filename(g_get_user_cache_dir(), "arsei_gstreamer", name, NULL);
+    std::string result(path);
+    g_free(path);
+    return result;
+}
+
+void ModelIndex::Walk(const std::string &dir) {
+    int64_t mtime;
+    bool is_dir;
+    if (!stat_mtime(dir, mtime, is_dir) || !is_dir)
+        return;
+    dirs.emplace_back(dir, mtime);
+
+    DIR *dir_handle = opendir(dir.c_str());
+    if (!dir_handle)
+        return;
+    std::vector<std::string> subdirs;
+    // The precision of a model is the name of the directory holding it (FP32, FP16, FP16-INT8)
+    std::string precision = to_upper_case(dir.substr(dir.find_last_of('/', dir.size() - 2) + 1));
+    if (!precision.empty() && precision.back() == '/')
+        precision.pop_back();
+
+    while (auto file_handle = readdir(dir_handle)) {
+        if (file_handle->d_name[0] == '.')
+            continue;
+        std::string name(file_handle->d_name);
+        std::string path = dir + name;
+        unsigned char type = file_handle->d_type;
+        // Some network file systems do not fill d_type
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            subdirs.push_back(path + "/");
+        } else if (type == DT_REG && name.size() > 4 && name.compare(name.size() - 4, 4, ".xml") == 0) {
+            // The first match in search order wins, as with FindModels
+            ModelEntry entry;
+            entry.xml = path;
+            entry.bin = path.substr(0, path.size() - 4) + ".bin";
+            auto &precisions = models[name];
+            if (!find_precision(precisions, precision))
+                precisions.emplace_back(precision, entry);
+        }
+    }
+    closedir(dir_handle);
+
+    for (const auto &subdir : subdirs)
+        Walk(subdir);
+}
+
+bool ModelIndex::Read(const std::string &path) {
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line != MODEL_INDEX_VERSION)
+        return false;
+
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string tag;
+        std::getline(fields, tag, '\t');
+        if (tag == "D") {
+            std::string mtime, dir;
+            std::getline(fields, mtime, '\t');
+            std::getline(fields, dir);
+            // A truncated or corrupt index is rebuilt
+            try {
+                dirs.emplace_back(dir, std::stoll(mtime));
+            } catch (const std::logic_error &) {
+                return false;
+            }
+        } else if (tag == "M") {
+            std::string name, precision;
+            ModelEntry entry;
+            std::getline(fields, name, '\t');
+            std::getline(fields, precision, '\t');
+            std::getline(fields, entry.xml, '\t');
+            std::getline(fields, entry.bin);
+            models[name].emplace_back(precision, entry);
+        } else {
+            return false;
+        }
+    }
+
+    // Adding or removing a model changes the mtime of the directory holding it
+    for (const auto &dir : dirs) {
+        int64_t mtime;
+        bool is_dir;
+        if (!stat_mtime(dir.first, mtime, is_dir) || mtime != dir.second)
+            return false;
+    }
+    return true;
+}
+
+void ModelIndex::Write(const std::string &path) const {
+    gchar *cache_dir = g_path_get_dirname(path.c_str());
+    g_mkdir_with_parents(cache_dir, 0755);
+    g_free(cache_dir);
+
+    // Write to a temporary file first so concurrent jobs never read a partial index
+    std::string tmp_path = path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp_path);
+        if (!file)
+            return;
+        file << MODEL_INDEX_VERSION << "\n";
+        for (const auto &dir : dirs)
+            file << "D\t" << dir.second << "\t" << dir.first << "\n";
+        for (const auto &model : models)
+            for (const auto &precision : model.second)
+                file << "M\t" << model.first << "\t" << precision.first << "\t" << precision.second.xml << "\t"
+                     << precision.second.bin << "\n";
+        if (!file)
+            return;
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0)
+        remove(tmp_path.c_str());
+}
+
+ModelIndex ModelIndex::Load(const std::vector<std::string> &search_dirs) {
+    std::string path = cache_path(search_dirs);
+    ModelIndex index;
+    if (index.Read(path)) {
+        index.cached = true;
+        return index;
+    }
+
+    index = ModelIndex();
+    for (const auto &dir : search_dirs)
+        index.Walk(dir.empty() || dir.back() == '/' ? dir : dir + "/");
+    index.Write(path);
+    return index;
+}
+
+const ModelEntry *ModelIndex::Find(const std::string &model_name, const std::string &precision) const {
+    auto model = models.find(model_name);
+    if (model == models.end() || model->second.empty())
+        return NULL;
+    const auto &precisions = model->second;
+    std::string wanted = to_upper_case(precision);
+    if (const ModelEntry *exact = find_precision(precisions, wanted))
+        return exact;
+    for (const auto &entry : precisions)
+        if (entry.first.find(wanted) != std::string::npos)
+            return &entry.second;
+    return &precisions.front().second;
+}
+
+std::vector<std::string> SplitString(const std::string input, char delimiter) {
+    std::vector<std::string> tokens;
+    std::string token;
+    std::istringstream tokenStream(input);
+    while (std::getline(tokenStream, token, delimiter)) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+std::map<std::string, std::string> FindModels(const std::vector<std::string> &search_dirs,
+                                              const std::vector<std::string> &model_names,
+                                              const std::string &precision) {
+    gint64 start = g_get_monotonic_time();
+    ModelIndex index = ModelIndex::Load(search_dirs);
+    std::map<std::string, std::string> result;
+    for (const std::string &model_name : model_names) {
+        const ModelEntry *entry = index.Find(model_name, precision);
+        if (!entry)
+            throw std::runtime_error("Can't find file for model: " + model_name);
+        result[model_name] = entry->xml;
+    }
+    g_print("Model lookup took %.1f ms (%s)\n", (g_get_monotonic_time() - start) / 1000.0,
+            index.from_cache() ? "cached index" : "index rebuilt");
+    return result;
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ModelEntry {
+    std::string xml;
+    std::string bin;
+};
+
+// Precision (parent directory name, upper case) -> files, in search order
+typedef std::vector<std::pair<std::string, ModelEntry>> ModelPrecisions;
+
+// Index of all IR models (*.xml) below a set of search directories, keyed by file name and precision.
+// The index is built with a single walk of the directories and cached on disk. The cache stores the
+// mtime of every directory it walked and is rebuilt as soon as one of them changes.
+class ModelIndex {
+  public:
+    // Loads the cached index for search_dirs, rebuilding it if it is missing or stale
+    static ModelIndex Load(const std::vector<std::string> &search_dirs);
+
+    // Returns the model for the requested precision (e.g. "FP16"), falling back to a precision
+    // containing it (e.g. "FP16-INT8") and then to the precision found first in search order.
+    // NULL if the model is unknown.
+    const ModelEntry *Find(const std::string &model_name, const std::string &precision) const;
+
+    bool from_cache() const {
+        return cached;
+    }
+
+  private:
+    void Walk(const std::string &dir);
+    bool Read(const std::string &path);
+    void Write(const std::string &path) const;
+
+    // model file name -> precisions
+    std::unordered_map<std::string, ModelPrecisions> models;
+    // every directory walked, with its modification time in nanoseconds
+    std::vector<std::pair<std::string, int64_t>> dirs;
+    bool cached = false;
+};
+
+std::vector<std::string> SplitString(const std::string input, char delimiter = ':');
+
+// Returns model file name -> path of the .xml file, throws if one of the models cannot be found
+std::map<std::string, std::string> FindModels(const std::vector<std::string> &search_dirs,
+                                              const std::vector<std::string> &model_names,
+                                              const std::string &precision);
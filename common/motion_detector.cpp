@@ -0,0 +1,147 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "motion_detector.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void LumaBlockMeans(const uint8_t *luma, int width, int height, int stride, std::vector<uint8_t> &means) {
+    int columns = width / MOTION_BLOCK_SIZE;
+    int rows = height / MOTION_BLOCK_SIZE;
+    means.resize(columns * rows);
+    std::vector<uint32_t> sums(columns);
+    for (int by = 0; by < rows; by++) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int y = 0; y < MOTION_BLOCK_SIZE; y++) {
+            const uint8_t *row = luma + (size_t)(by * MOTION_BLOCK_SIZE + y) * stride;
+#if defined(__SSE2__) && MOTION_BLOCK_SIZE == 16
+            // psadbw against zero sums each half of the 16 pixels
+            const __m128i zero = _mm_setzero_si128();
+            for (int bx = 0; bx < columns; bx++) {
+                __m128i sad = _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + bx * 16)), zero);
+                sums[bx] += _mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4);
+            }
+#else
+            for (int bx = 0; bx < columns; bx++)
+                for (int x = 0; x < MOTION_BLOCK_SIZE; x++)
+                    sums[bx] += row[bx * MOTION_BLOCK_SIZE + x];
+#endif
+        }
+        for (int bx = 0; bx < columns; bx++)
+            means[by * columns + bx] = sums[bx] / (MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE);
+    }
+}
+
+MotionDetector::MotionDetector(int threshold) : threshold(threshold) {
+}
+
+bool MotionDetector::enabled() const {
+    return threshold > 0;
+}
+
+bool MotionDetector::Compare(const uint8_t *luma, int width, int height, int stride) {
+    LumaBlockMeans(luma, width, height, stride, current);
+    bool resized = width / MOTION_BLOCK_SIZE != columns || height / MOTION_BLOCK_SIZE != rows;
+    columns = width / MOTION_BLOCK_SIZE;
+    rows = height / MOTION_BLOCK_SIZE;
+    changed_blocks.assign(current.size(), true);
+    if (resized || reference.size() != current.size()) {
+        reference.clear();
+        return true;
+    }
+    bool any = false;
+    for (size_t i = 0; i < current.size(); i++) {
+        changed_blocks[i] = std::abs(int(current[i]) - int(reference[i])) > threshold;
+        any = any || changed_blocks[i];
+    }
+    return any;
+}
+
+void MotionDetector::Accept() {
+    reference = current;
+}
+
+namespace {
+
+bool Overlap(const FrameRegion &a, const FrameRegion &b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+FrameRegion Union(const FrameRegion &a, const FrameRegion &b) {
+    int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.w, b.x + b.w), y1 = std::max(a.y + a.h, b.y + b.h);
+    return {x0, y0, x1 - x0, y1 - y0};
+}
+
+// Grows the range [start, start + size) to at least min_size around its center, within [0, limit)
+void Grow(int &start, int &size, int min_size, int limit) {
+    if (size >= min_size)
+        return;
+    int grown = std::min(min_size, limit);
+    start = std::min(std::max(start + size / 2 - grown / 2, 0), limit - grown);
+    size = grown;
+}
+
+} // namespace
+
+std::vector<FrameRegion> MotionDetector::ChangedRegions(int width, int height, int margin, int min_size) const {
+    std::vector<FrameRegion> regions;
+    // Groups of 8-connected changed blocks
+    std::vector<bool> seen(changed_blocks.size());
+    for (size_t start = 0; start < changed_blocks.size(); start++) {
+        if (!changed_blocks[start] || seen[start])
+            continue;
+        int bx0 = columns, by0 = rows, bx1 = -1, by1 = -1;
+        std::queue<int> queue;
+        queue.push(start);
+        seen[start] = true;
+        while (!queue.empty()) {
+            int block = queue.front();
+            queue.pop();
+            int bx = block % columns, by = block / columns;
+            bx0 = std::min(bx0, bx), by0 = std::min(by0, by);
+            bx1 = std::max(bx1, bx), by1 = std::max(by1, by);
+            for (int ny = std::max(by - 1, 0); ny <= std::min(by + 1, rows - 1); ny++)
+                for (int nx = std::max(bx - 1, 0); nx <= std::min(bx + 1, columns - 1); nx++) {
+                    int next = ny * columns + nx;
+                    if (changed_blocks[next] && !seen[next]) {
+                        seen[next] = true;
+                        queue.push(next);
+                    }
+                }
+        }
+        // Blocks at the last column or row take the partial block behind them along
+        int x0 = bx0 * MOTION_BLOCK_SIZE, y0 = by0 * MOTION_BLOCK_SIZE;
+        int x1 = bx1 == columns - 1 ? width : (bx1 + 1) * MOTION_BLOCK_SIZE;
+        int y1 = by1 == rows - 1 ? height : (by1 + 1) * MOTION_BLOCK_SIZE;
+        x0 = std::max(x0 - margin, 0), y0 = std::max(y0 - margin, 0);
+        x1 = std::min(x1 + margin, width), y1 = std::min(y1 + margin, height);
+        FrameRegion region = {x0, y0, x1 - x0, y1 - y0};
+        Grow(region.x, region.w, min_size, width);
+        Grow(region.y, region.h, min_size, height);
+        regions.push_back(region);
+    }
+
+    // Merge until no two regions overlap
+    for (bool merged = true; merged;) {
+        merged = false;
+        for (size_t i = 0; i < regions.size() && !merged; i++)
+            for (size_t j = i + 1; j < regions.size(); j++)
+                if (Overlap(regions[i], regions[j])) {
+                    regions[i] = Union(regions[i], regions[j]);
+                    regions.erase(regions.begin() + j);
+                    merged = true;
+                    break;
+                }
+    }
+    return regions;
+}
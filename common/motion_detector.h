@@ -0,0 +1,66 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Side of the square luma blocks that are compared
+#define MOTION_BLOCK_SIZE 16
+
+// Rectangle in pixels
+struct FrameRegion {
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// Finds the parts of a frame that changed since a reference frame. Both frames are reduced
+// to the mean luma of MOTION_BLOCK_SIZE blocks, a block changed if its mean differs by more
+// than threshold levels. Partial blocks at the right and bottom edge are not compared.
+class MotionDetector {
+  public:
+    explicit MotionDetector(int threshold);
+
+    // False if every frame counts as changed
+    bool enabled() const;
+
+    // Compares the luma plane with the reference, true if any block changed. The first
+    // frame and frames of another size always count as changed.
+    bool Compare(const uint8_t *luma, int width, int height, int stride);
+    // Makes the last compared frame the reference
+    void Accept();
+
+    // Changed blocks of the last comparison, row by row
+    const std::vector<bool> &changed() const {
+        return changed_blocks;
+    }
+    int blocks_x() const {
+        return columns;
+    }
+    int blocks_y() const {
+        return rows;
+    }
+
+    // Bounding boxes of the groups of changed blocks of the last comparison, grown by margin
+    // pixels and merged until they don't overlap, at least min_size pixels wide and high
+    // where the frame allows it. Cover the frame up to width x height, so partial blocks at
+    // the edges are included next to changed blocks.
+    std::vector<FrameRegion> ChangedRegions(int width, int height, int margin, int min_size) const;
+
+  private:
+    int threshold;
+    int columns = 0;
+    int rows = 0;
+    std::vector<uint8_t> reference;
+    std::vector<uint8_t> current;
+    std::vector<bool> changed_blocks;
+};
+
+// Mean luma of every MOTION_BLOCK_SIZE block, row by row
+void LumaBlockMeans(const uint8_t *luma, int width, int height, int stride, std::vector<uint8_t> &means);
@@ -0,0 +1,295 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "nv12_roi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NV12_ROI_X86 1
+#include <immintrin.h>
+#else
+#define NV12_ROI_X86 0
+#endif
+
+namespace {
+
+// One output row of a region: horizontal interpolation of the two source rows of each plane,
+// vertical interpolation, colour conversion and normalization
+struct RowArgs {
+    const float *y0, *y1;           // luma rows above and below, widened to float
+    const float *u0, *u1, *v0, *v1; // chroma rows above and below
+    const int *luma_index;          // left source column of every output column
+    const float *luma_weight;       // weight of the right source column
+    const int *chroma_index;
+    const float *chroma_weight;
+    float luma_fy; // weight of the lower source row
+    float chroma_fy;
+    int width;
+    float mean;
+    float scale;
+    float *b, *g, *r;
+};
+
+// BT.601 limited range
+#define CONV_Y 1.164f
+#define CONV_RV 1.596f
+#define CONV_GU -0.392f
+#define CONV_GV -0.813f
+#define CONV_BU 2.017f
+
+inline float Lerp(const float *row, int index, float weight) {
+    return row[index] + weight * (row[index + 1] - row[index]);
+}
+
+inline float Clamp(float v) {
+    return std::min(std::max(v, 0.0f), 255.0f);
+}
+
+void ConvertPixelsScalar(const RowArgs &a, int begin) {
+    for (int x = begin; x < a.width; x++) {
+        float top = Lerp(a.y0, a.luma_index[x], a.luma_weight[x]);
+        float y = top + a.luma_fy * (Lerp(a.y1, a.luma_index[x], a.luma_weight[x]) - top);
+        float u_top = Lerp(a.u0, a.chroma_index[x], a.chroma_weight[x]);
+        float u = u_top + a.chroma_fy * (Lerp(a.u1, a.chroma_index[x], a.chroma_weight[x]) - u_top);
+        float v_top = Lerp(a.v0, a.chroma_index[x], a.chroma_weight[x]);
+        float v = v_top + a.chroma_fy * (Lerp(a.v1, a.chroma_index[x], a.chroma_weight[x]) - v_top);
+        float c = (y - 16.0f) * CONV_Y, d = u - 128.0f, e = v - 128.0f;
+        a.r[x] = (Clamp(c + CONV_RV * e) - a.mean) * a.scale;
+        a.g[x] = (Clamp(c + CONV_GU * d + CONV_GV * e) - a.mean) * a.scale;
+        a.b[x] = (Clamp(c + CONV_BU * d) - a.mean) * a.scale;
+    }
+}
+
+void ConvertRowScalar(const RowArgs &a) {
+    ConvertPixelsScalar(a, 0);
+}
+
+#if NV12_ROI_X86
+__attribute__((target("avx2,fma"))) inline __m256 LerpAvx2(const float *row, __m256i index, __m256 weight) {
+    __m256 left = _mm256_i32gather_ps(row, index, 4);
+    __m256 right = _mm256_i32gather_ps(row + 1, index, 4);
+    return _mm256_fmadd_ps(weight, _mm256_sub_ps(right, left), left);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256 BlendAvx2(__m256 top, __m256 bottom, __m256 fy) {
+    return _mm256_fmadd_ps(fy, _mm256_sub_ps(bottom, top), top);
+}
+
+__attribute__((target("avx2,fma"))) void ConvertRowAvx2(const RowArgs &a) {
+    const __m256 luma_fy = _mm256_set1_ps(a.luma_fy), chroma_fy = _mm256_set1_ps(a.chroma_fy);
+    const __m256 zero = _mm256_setzero_ps(), max = _mm256_set1_ps(255.0f);
+    const __m256 mean = _mm256_set1_ps(a.mean), scale = _mm256_set1_ps(a.scale);
+    int x = 0;
+    for (; x + 8 <= a.width; x += 8) {
+        __m256i li = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a.luma_index + x));
+        __m256 lw = _mm256_loadu_ps(a.luma_weight + x);
+        __m256i ci = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a.chroma_index + x));
+        __m256 cw = _mm256_loadu_ps(a.chroma_weight + x);
+        __m256 y = BlendAvx2(LerpAvx2(a.y0, li, lw), LerpAvx2(a.y1, li, lw), luma_fy);
+        __m256 u = BlendAvx2(LerpAvx2(a.u0, ci, cw), LerpAvx2(a.u1, ci, cw), chroma_fy);
+        __m256 v = BlendAvx2(LerpAvx2(a.v0, ci, cw), LerpAvx2(a.v1, ci, cw), chroma_fy);
+        __m256 c = _mm256_mul_ps(_mm256_sub_ps(y, _mm256_set1_ps(16.0f)), _mm256_set1_ps(CONV_Y));
+        __m256 d = _mm256_sub_ps(u, _mm256_set1_ps(128.0f));
+        __m256 e = _mm256_sub_ps(v, _mm256_set1_ps(128.0f));
+        __m256 r = _mm256_fmadd_ps(_mm256_set1_ps(CONV_RV), e, c);
+        __m256 g = _mm256_fmadd_ps(_mm256_set1_ps(CONV_GV), e, _mm256_fmadd_ps(_mm256_set1_ps(CONV_GU), d, c));
+        __m256 b = _mm256_fmadd_ps(_mm256_set1_ps(CONV_BU), d, c);
+        r = _mm256_min_ps(_mm256_max_ps(r, zero), max);
+        g = _mm256_min_ps(_mm256_max_ps(g, zero), max);
+        b = _mm256_min_ps(_mm256_max_ps(b, zero), max);
+        _mm256_storeu_ps(a.r + x, _mm256_mul_ps(_mm256_sub_ps(r, mean), scale));
+        _mm256_storeu_ps(a.g + x, _mm256_mul_ps(_mm256_sub_ps(g, mean), scale));
+        _mm256_storeu_ps(a.b + x, _mm256_mul_ps(_mm256_sub_ps(b, mean), scale));
+    }
+    ConvertPixelsScalar(a, x);
+}
+
+__attribute__((target("avx512f"))) inline __m512 LerpAvx512(const float *row, __m512i index, __m512 weight) {
+    __m512 left = _mm512_i32gather_ps(index, row, 4);
+    __m512 right = _mm512_i32gather_ps(index, row + 1, 4);
+    return _mm512_fmadd_ps(weight, _mm512_sub_ps(right, left), left);
+}
+
+__attribute__((target("avx512f"))) inline __m512 BlendAvx512(__m512 top, __m512 bottom, __m512 fy) {
+    return _mm512_fmadd_ps(fy, _mm512_sub_ps(bottom, top), top);
+}
+
+__attribute__((target("avx512f"))) void ConvertRowAvx512(const RowArgs &a) {
+    const __m512 luma_fy = _mm512_set1_ps(a.luma_fy), chroma_fy = _mm512_set1_ps(a.chroma_fy);
+    const __m512 zero = _mm512_setzero_ps(), max = _mm512_set1_ps(255.0f);
+    const __m512 mean = _mm512_set1_ps(a.mean), scale = _mm512_set1_ps(a.scale);
+    int x = 0;
+    for (; x + 16 <= a.width; x += 16) {
+        __m512i li = _mm512_loadu_si512(a.luma_index + x);
+        __m512 lw = _mm512_loadu_ps(a.luma_weight + x);
+        __m512i ci = _mm512_loadu_si512(a.chroma_index + x);
+        __m512 cw = _mm512_loadu_ps(a.chroma_weight + x);
+        __m512 y = BlendAvx512(LerpAvx512(a.y0, li, lw), LerpAvx512(a.y1, li, lw), luma_fy);
+        __m512 u = BlendAvx512(LerpAvx512(a.u0, ci, cw), LerpAvx512(a.u1, ci, cw), chroma_fy);
+        __m512 v = BlendAvx512(LerpAvx512(a.v0, ci, cw), LerpAvx512(a.v1, ci, cw), chroma_fy);
+        __m512 c = _mm512_mul_ps(_mm512_sub_ps(y, _mm512_set1_ps(16.0f)), _mm512_set1_ps(CONV_Y));
+        __m512 d = _mm512_sub_ps(u, _mm512_set1_ps(128.0f));
+        __m512 e = _mm512_sub_ps(v, _mm512_set1_ps(128.0f));
+        __m512 r = _mm512_fmadd_ps(_mm512_set1_ps(CONV_RV), e, c);
+        __m512 g = _mm512_fmadd_ps(_mm512_set1_ps(CONV_GV), e, _mm512_fmadd_ps(_mm512_set1_ps(CONV_GU), d, c));
+        __m512 b = _mm512_fmadd_ps(_mm512_set1_ps(CONV_BU), d, c);
+        r = _mm512_min_ps(_mm512_max_ps(r, zero), max);
+        g = _mm512_min_ps(_mm512_max_ps(g, zero), max);
+        b = _mm512_min_ps(_mm512_max_ps(b, zero), max);
+        _mm512_storeu_ps(a.r + x, _mm512_mul_ps(_mm512_sub_ps(r, mean), scale));
+        _mm512_storeu_ps(a.g + x, _mm512_mul_ps(_mm512_sub_ps(g, mean), scale));
+        _mm512_storeu_ps(a.b + x, _mm512_mul_ps(_mm512_sub_ps(b, mean), scale));
+    }
+    ConvertPixelsScalar(a, x);
+}
+#endif
+
+struct Kernel {
+    const char *name;
+    void (*convert_row)(const RowArgs &);
+    bool (*supported)();
+};
+
+bool Always() {
+    return true;
+}
+
+#if NV12_ROI_X86
+bool HasAvx2() {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+bool HasAvx512() {
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+// Fastest first
+const Kernel kernels[] = {
+#if NV12_ROI_X86
+    {"avx512", ConvertRowAvx512, HasAvx512},
+    {"avx2", ConvertRowAvx2, HasAvx2},
+#endif
+    {"scalar", ConvertRowScalar, Always},
+};
+
+const Kernel *&ActiveKernel() {
+    static const Kernel *active = [] {
+        for (const Kernel &kernel : kernels)
+            if (kernel.supported())
+                return &kernel;
+        return &kernels[sizeof(kernels) / sizeof(kernels[0]) - 1];
+    }();
+    return active;
+}
+
+// Source position of every output column (or row), as the left sample and the weight of the
+// right one. Sample centers are aligned, positions are clamped to [0, size - 1].
+void Positions(int out_size, int size, double offset, double step, std::vector<int> &index,
+               std::vector<float> &weight) {
+    index.resize(out_size);
+    weight.resize(out_size);
+    for (int i = 0; i < out_size; i++) {
+        double pos = std::min(std::max(offset + (i + 0.5) * step - 0.5, 0.0), double(size - 1));
+        index[i] = std::min((int)pos, size - 1);
+        weight[i] = float(pos - index[i]);
+    }
+}
+
+// Widens count bytes, every stride-th from src, to float and repeats the last one behind them
+void Widen(const uint8_t *src, int count, int stride, float *dst) {
+    for (int i = 0; i < count; i++)
+        dst[i] = src[i * stride];
+    dst[count] = dst[count - 1];
+}
+
+} // namespace
+
+void Nv12RegionsToPlanarBgr(const Nv12Frame &frame, const std::vector<FrameRegion> &regions, int out_width,
+                            int out_height, float *tensor, float mean, float scale) {
+    const Kernel *kernel = ActiveKernel();
+    size_t plane_size = (size_t)out_width * out_height;
+    std::vector<int> luma_index, chroma_index, row_index, chroma_row_index;
+    std::vector<float> luma_weight, chroma_weight, row_weight, chroma_row_weight;
+    std::vector<float> rows;
+    for (size_t n = 0; n < regions.size(); n++) {
+        float *b = tensor + n * 3 * plane_size;
+        float *g = b + plane_size;
+        float *r = g + plane_size;
+        int x0 = std::max(regions[n].x, 0), y0 = std::max(regions[n].y, 0);
+        int x1 = std::min(regions[n].x + regions[n].w, frame.width);
+        int y1 = std::min(regions[n].y + regions[n].h, frame.height);
+        if (x1 <= x0 || y1 <= y0) {
+            std::fill(b, b + 3 * plane_size, 0.0f);
+            continue;
+        }
+        int w = x1 - x0, h = y1 - y0;
+        // Chroma samples covering the region
+        int cx0 = x0 / 2, cy0 = y0 / 2;
+        int cw = (x1 - 1) / 2 - cx0 + 1, ch = (y1 - 1) / 2 - cy0 + 1;
+
+        double step_x = double(w) / out_width, step_y = double(h) / out_height;
+        Positions(out_width, w, 0.0, step_x, luma_index, luma_weight);
+        // MPEG-2 siting: chroma samples sit on the even luma columns and between the luma rows
+        Positions(out_width, cw, (x0 - 2 * cx0) / 2.0 + 0.25, step_x / 2, chroma_index, chroma_weight);
+        Positions(out_height, h, 0.0, step_y, row_index, row_weight);
+        Positions(out_height, ch, (y0 - 2 * cy0) / 2.0, step_y / 2, chroma_row_index, chroma_row_weight);
+
+        rows.resize(2 * (w + 1) + 4 * (cw + 1));
+        float *luma_rows[2] = {rows.data(), rows.data() + w + 1};
+        float *u_rows[2] = {luma_rows[1] + w + 1, luma_rows[1] + w + 1 + cw + 1};
+        float *v_rows[2] = {u_rows[1] + cw + 1, u_rows[1] + 2 * (cw + 1)};
+
+        int widened_luma = -1, widened_chroma = -1;
+        for (int oy = 0; oy < out_height; oy++) {
+            int ly = row_index[oy], cy = chroma_row_index[oy];
+            // Consecutive output rows mostly share their source rows
+            if (ly != widened_luma) {
+                for (int i = 0; i < 2; i++) {
+                    int sy = y0 + std::min(ly + i, h - 1);
+                    Widen(frame.y + (size_t)sy * frame.y_stride + x0, w, 1, luma_rows[i]);
+                }
+                widened_luma = ly;
+            }
+            if (cy != widened_chroma) {
+                for (int i = 0; i < 2; i++) {
+                    const uint8_t *uv = frame.uv + (size_t)(cy0 + std::min(cy + i, ch - 1)) * frame.uv_stride + 2 * cx0;
+                    Widen(uv, cw, 2, u_rows[i]);
+                    Widen(uv + 1, cw, 2, v_rows[i]);
+                }
+                widened_chroma = cy;
+            }
+            RowArgs args;
+            args.y0 = luma_rows[0], args.y1 = luma_rows[1];
+            args.u0 = u_rows[0], args.u1 = u_rows[1];
+            args.v0 = v_rows[0], args.v1 = v_rows[1];
+            args.luma_index = luma_index.data(), args.luma_weight = luma_weight.data();
+            args.chroma_index = chroma_index.data(), args.chroma_weight = chroma_weight.data();
+            args.luma_fy = row_weight[oy], args.chroma_fy = chroma_row_weight[oy];
+            args.width = out_width, args.mean = mean, args.scale = scale;
+            args.b = b + (size_t)oy * out_width;
+            args.g = g + (size_t)oy * out_width;
+            args.r = r + (size_t)oy * out_width;
+            kernel->convert_row(args);
+        }
+    }
+}
+
+const char *Nv12RegionsKernel() {
+    return ActiveKernel()->name;
+}
+
+bool SetNv12RegionsKernel(const char *name) {
+    for (const Kernel &kernel : kernels)
+        if (strcmp(kernel.name, name) == 0 && kernel.supported()) {
+            ActiveKernel() = &kernel;
+            return true;
+        }
+    return false;
+}
@@ -0,0 +1,36 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "motion_detector.h"
+
+struct Nv12Frame {
+    const uint8_t *y;
+    int y_stride;
+    const uint8_t *uv; // interleaved U and V at half resolution
+    int uv_stride;
+    int width;
+    int height;
+};
+
+// Crops the regions out of an NV12 frame, resizes them bilinearly to out_width x
+// out_height and converts them (BT.601, limited range) to planar BGR in one pass. The result
+// is the batched NCHW float input tensor of a classification model: region after region,
+// the B, G and R planes of each. Every value is (v - mean) * scale. Regions are clipped to
+// the frame, empty regions give a zero tensor entry.
+void Nv12RegionsToPlanarBgr(const Nv12Frame &frame, const std::vector<FrameRegion> &regions, int out_width,
+                            int out_height, float *tensor, float mean = 0.0f, float scale = 1.0f);
+
+// Instruction set the kernel uses on this CPU: "avx512", "avx2" or "scalar"
+const char *Nv12RegionsKernel();
+
+// Restricts the kernel to the given instruction set, for comparisons. Returns false if the
+// CPU doesn't support it.
+bool SetNv12RegionsKernel(const char *name);
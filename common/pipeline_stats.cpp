@@ -0,0 +1,247 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "pipeline_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "classifier_branches.h"
+
+// Buffers an element dropped are forgotten once this many others are waiting
+#define MAX_PENDING_BUFFERS 256
+
+void LatencyHistogram::Add(gint64 us) {
+    us = std::max<gint64>(us, 0);
+    int bucket = us < 1 ? 0 : std::min((int)std::ceil(4 * std::log2((double)us)), BUCKETS - 1);
+    counts[bucket]++;
+    total++;
+    sum += us;
+    maximum = std::max(maximum, us);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+    for (int i = 0; i < BUCKETS; i++)
+        counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    maximum = std::max(maximum, other.maximum);
+}
+
+double LatencyHistogram::Percentile(double fraction) const {
+    if (total == 0)
+        return 0.0;
+    guint64 rank = (guint64)std::ceil(fraction * total);
+    guint64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank && seen > 0)
+            return std::min(std::exp2(i / 4.0), (double)maximum);
+    }
+    return (double)maximum;
+}
+
+PipelineStats::PipelineStats(const std::string &path, int interval_s)
+    : path(path), interval_s(interval_s), start_us(g_get_monotonic_time()) {
+    if (interval_s > 0)
+        writer = std::thread(&PipelineStats::WritePeriodically, this);
+}
+
+PipelineStats::~PipelineStats() {
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    writer_wakeup.notify_all();
+    if (writer.joinable())
+        writer.join();
+}
+
+void PipelineStats::WritePeriodically() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while (!writer_wakeup.wait_for(lock, std::chrono::seconds(interval_s), [this] { return stopping; }))
+        Write();
+}
+
+void PipelineStats::Attach(GstElement *pipeline) {
+    std::lock_guard<std::mutex> lock(attach_mutex);
+    pipelines.emplace_back(new Pipeline());
+    Pipeline *stats_pipeline = pipelines.back().get();
+
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+        GstPad *sink_pad = gst_element_get_static_pad(element, "sink");
+        GstPad *src_pad = gst_element_get_static_pad(element, "src");
+        gchar *name = gst_element_get_name(element);
+        if (sink_pad && src_pad) {
+            stages.emplace_back(new Stage());
+            Stage *stage = stages.back().get();
+            stage->pipeline = stats_pipeline;
+            stage->name = name;
+            stage->queue = strcmp(G_OBJECT_TYPE_NAME(element), "GstQueue") == 0 ? element : NULL;
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, Enter, stage, NULL);
+            gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, Leave, stage, NULL);
+        } else if (sink_pad && GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SINK) &&
+                   GST_OBJECT_PARENT(element) == GST_OBJECT(pipeline) &&
+                   !g_str_has_prefix(name, CLASSIFIER_BRANCH_PREFIX)) {
+            // Frames end here. Sinks inside sink bins (fpsdisplaysink) would count them again,
+            // the fakesinks of parallel classifiers only see copies.
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, Arrive, stats_pipeline, NULL);
+        }
+        g_free(name);
+        if (sink_pad)
+            gst_object_unref(sink_pad);
+        if (src_pad)
+            gst_object_unref(src_pad);
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+}
+
+GstPadProbeReturn PipelineStats::Enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Stage *stage = static_cast<Stage *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    std::lock_guard<std::mutex> lock(stage->mutex);
+    if (stage->entered.size() >= MAX_PENDING_BUFFERS)
+        stage->entered.erase(stage->entered.begin());
+    stage->entered[GST_BUFFER_PTS(buffer)] = g_get_monotonic_time();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn PipelineStats::Leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Stage *stage = static_cast<Stage *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    gint64 now = g_get_monotonic_time();
+    guint level = 0;
+    if (stage->queue)
+        g_object_get(stage->queue, "current-level-buffers", &level, NULL);
+    {
+        std::lock_guard<std::mutex> lock(stage->mutex);
+        auto it = stage->entered.find(pts);
+        if (it != stage->entered.end()) {
+            stage->time.Add(now - it->second);
+            stage->entered.erase(it);
+        }
+        if (stage->queue) {
+            stage->level_sum += level;
+            stage->level_max = std::max(stage->level_max, level);
+            stage->level_samples++;
+        }
+    }
+    Pipeline *pipeline = stage->pipeline;
+    std::lock_guard<std::mutex> lock(pipeline->mutex);
+    if (pipeline->first_seen.count(pts) == 0) {
+        if (pipeline->first_seen.size() >= MAX_PENDING_BUFFERS)
+            pipeline->first_seen.erase(pipeline->first_seen.begin());
+        pipeline->first_seen[pts] = now;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn PipelineStats::Arrive(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Pipeline *pipeline = static_cast<Pipeline *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer)
+        return GST_PAD_PROBE_OK;
+    gint64 now = g_get_monotonic_time();
+    std::lock_guard<std::mutex> lock(pipeline->mutex);
+    if (pipeline->frames++ == 0)
+        pipeline->first_frame_us = now;
+    pipeline->last_frame_us = now;
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    auto it = pipeline->first_seen.find(GST_BUFFER_PTS(buffer));
+    if (it != pipeline->first_seen.end()) {
+        pipeline->latency.Add(now - it->second);
+        pipeline->first_seen.erase(it);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void write_histogram(FILE *file, const LatencyHistogram &histogram) {
+    fprintf(file,
+            "\"count\": %" G_GUINT64_FORMAT ", \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+            "\"p99_ms\": %.3f, \"max_ms\": %.3f",
+            histogram.count(), histogram.mean() / 1000, histogram.Percentile(0.5) / 1000,
+            histogram.Percentile(0.95) / 1000, histogram.Percentile(0.99) / 1000, histogram.max() / 1000.0);
+}
+
+bool PipelineStats::Write() const {
+    // Elements of the same name in several pipelines are summed up, in order of appearance
+    std::vector<std::string> names;
+    std::map<std::string, LatencyHistogram> times;
+    std::map<std::string, std::pair<double, guint>> levels; // mean, max
+    std::map<std::string, guint64> level_samples;
+    // Also keeps the periodic and the final write apart
+    std::lock_guard<std::mutex> attached(attach_mutex);
+    for (const auto &stage : stages) {
+        std::lock_guard<std::mutex> lock(stage->mutex);
+        if (times.count(stage->name) == 0)
+            names.push_back(stage->name);
+        times[stage->name].Merge(stage->time);
+        if (stage->queue) {
+            auto &level = levels[stage->name];
+            level.first += stage->level_sum;
+            level.second = std::max(level.second, stage->level_max);
+            level_samples[stage->name] += stage->level_samples;
+        }
+    }
+    LatencyHistogram latency;
+    guint64 frames = 0;
+    double fps = 0;
+    for (const auto &pipeline : pipelines) {
+        std::lock_guard<std::mutex> lock(pipeline->mutex);
+        latency.Merge(pipeline->latency);
+        frames += pipeline->frames;
+        gint64 duration_us = pipeline->last_frame_us - pipeline->first_frame_us;
+        if (pipeline->frames > 1 && duration_us > 0)
+            fps += (pipeline->frames - 1) * 1e6 / duration_us;
+    }
+
+    // Written to a temporary file first so that readers never see half a file
+    std::string temporary = path + ".tmp";
+    FILE *file = path == "-" ? stdout : fopen(temporary.c_str(), "w");
+    if (!file)
+        return false;
+    fprintf(file, "{\n  \"elapsed_s\": %.3f,\n  \"frames\": %" G_GUINT64_FORMAT ",\n  \"fps\": %.2f,\n",
+            (g_get_monotonic_time() - start_us) / 1e6, frames, fps);
+    fprintf(file, "  \"latency\": {");
+    write_histogram(file, latency);
+    fprintf(file, "},\n  \"elements\": {");
+    for (size_t i = 0; i < names.size(); i++) {
+        fprintf(file, "%s\n    \"%s\": {", i ? "," : "", names[i].c_str());
+        write_histogram(file, times[names[i]]);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  },\n  \"queues\": {");
+    size_t i = 0;
+    for (const auto &level : levels) {
+        guint64 samples = level_samples[level.first];
+        fprintf(file, "%s\n    \"%s\": {\"mean_level\": %.2f, \"max_level\": %u}", i++ ? "," : "",
+                level.first.c_str(), samples ? level.second.first / samples : 0.0, level.second.second);
+    }
+    fprintf(file, "\n  }\n}\n");
+    if (file == stdout) {
+        fflush(stdout);
+        return true;
+    }
+    bool ok = fclose(file) == 0;
+    return ok && rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <condition_variable>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Durations in microseconds in logarithmic buckets, four per octave, so percentiles are
+// accurate to about 10%
+class LatencyHistogram {
+  public:
+    void Add(gint64 us);
+    // Adds the counts of another histogram
+    void Merge(const LatencyHistogram &other);
+
+    // Upper bound of the bucket holding the given fraction (0 - 1) of the values
+    double Percentile(double fraction) const;
+
+    guint64 count() const {
+        return total;
+    }
+    double mean() const {
+        return total ? double(sum) / total : 0.0;
+    }
+    gint64 max() const {
+        return maximum;
+    }
+
+  private:
+    static const int BUCKETS = 4 * 40;
+    guint64 counts[BUCKETS] = {};
+    guint64 total = 0;
+    gint64 sum = 0;
+    gint64 maximum = 0;
+};
+
+// Statistics of pipelines for sizing and regression checks: the time buffers spend in every
+// element with a sink and a src pad (including time waiting in the element, as StageTimer),
+// the fill levels of the queues, the latency of every frame from the first element with a
+// timestamped output to a sink, and the frame rate at the sinks. Frames are matched by
+// timestamp within each pipeline. Written as JSON at the end and, optionally, periodically.
+class PipelineStats {
+  public:
+    // Writes to path, "-" for stdout. With interval_s > 0 the file is rewritten that often
+    // while the pipelines run.
+    PipelineStats(const std::string &path, int interval_s);
+    ~PipelineStats();
+
+    // Installs the probes on all elements of the pipeline, which has to be destroyed before
+    // this object
+    void Attach(GstElement *pipeline);
+
+    // Writes the statistics, returns false if the file can't be written
+    bool Write() const;
+
+  private:
+    struct Pipeline;
+    struct Stage {
+        Pipeline *pipeline;
+        std::string name;
+        GstElement *queue; // not owned, NULL for elements other than queues
+        std::mutex mutex;
+        std::map<GstClockTime, gint64> entered;
+        LatencyHistogram time;
+        guint64 level_sum = 0;
+        guint level_max = 0;
+        guint64 level_samples = 0;
+    };
+    struct Pipeline {
+        std::mutex mutex;
+        // First time every frame left an element
+        std::map<GstClockTime, gint64> first_seen;
+        LatencyHistogram latency;
+        guint64 frames = 0;
+        gint64 first_frame_us = 0;
+        gint64 last_frame_us = 0;
+    };
+
+    static GstPadProbeReturn Enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn Leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn Arrive(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void WritePeriodically();
+
+    std::string path;
+    int interval_s;
+    gint64 start_us;
+    mutable std::mutex attach_mutex; // pipelines are attached while others run
+    std::vector<std::unique_ptr<Pipeline>> pipelines;
+    std::vector<std::unique_ptr<Stage>> stages;
+
+    std::mutex writer_mutex;
+    std::condition_variable writer_wakeup;
+    bool stopping = false;
+    std::thread writer;
+};
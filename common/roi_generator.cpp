@@ -0,0 +1,130 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "roi_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <gst/video/gstvideometa.h>
+#include <gst/video/video.h>
+
+RoiGenerator::RoiGenerator(const RoiGeneratorConfig &config)
+    : config(config), random(config.seed), objects(std::max(config.objects, 0)) {
+    for (int i = 0; i < config.labels; i++)
+        labels.push_back("class" + std::to_string(i));
+}
+
+void RoiGenerator::Attach(GstPad *pad) {
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, AddRegions, this, NULL);
+}
+
+// A new object of random size and position, moving in a random direction
+void RoiGenerator::Place(Object &object) {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    object.w = std::max(16.0, width * (0.025 + 0.1 * uniform(random)));
+    object.h = std::min(object.w * (1.0 + 0.4 * uniform(random)), height / 2.0);
+    object.x = (width - object.w) * uniform(random);
+    object.y = (height - object.h) * uniform(random);
+    object.vx = config.speed * (2 * uniform(random) - 1);
+    object.vy = config.speed * (2 * uniform(random) - 1);
+    object.label = labels.empty() ? 0 : std::uniform_int_distribution<int>(0, labels.size() - 1)(random);
+    object.present = true;
+}
+
+// Moves one coordinate by its velocity, reflecting it at the borders
+static void Walk(double &position, double &velocity, double size, double limit) {
+    position += velocity;
+    if (position < 0) {
+        position = -position;
+        velocity = -velocity;
+    } else if (position + size > limit) {
+        position = 2 * (limit - size) - position;
+        velocity = -velocity;
+    }
+    position = std::min(std::max(position, 0.0), limit - size);
+}
+
+void RoiGenerator::Step() {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double acceleration = config.speed / 4;
+    for (Object &object : objects) {
+        if (!object.present) {
+            if (config.appear > 0 && uniform(random) < config.appear) {
+                Place(object);
+                num_changes++;
+            }
+            continue;
+        }
+        if (config.disappear > 0 && uniform(random) < config.disappear) {
+            object.present = false;
+            num_changes++;
+            continue;
+        }
+        if (config.speed > 0) {
+            object.vx = std::min(std::max(object.vx + acceleration * (2 * uniform(random) - 1), -config.speed),
+                                 config.speed);
+            object.vy = std::min(std::max(object.vy + acceleration * (2 * uniform(random) - 1), -config.speed),
+                                 config.speed);
+            Walk(object.x, object.vx, object.w, width);
+            Walk(object.y, object.vy, object.h, height);
+        }
+        if (labels.size() > 1 && config.label_churn > 0 && uniform(random) < config.label_churn) {
+            // Any label but the current one
+            int other = std::uniform_int_distribution<int>(1, labels.size() - 1)(random);
+            object.label = (object.label + other) % labels.size();
+            num_changes++;
+        }
+    }
+}
+
+GstPadProbeReturn RoiGenerator::AddRegions(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RoiGenerator *generator = static_cast<RoiGenerator *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer)
+        return GST_PAD_PROBE_OK;
+
+    if (generator->width == 0) {
+        // The objects are placed once the frame size is known
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        GstVideoInfo video_info;
+        bool ok = caps && gst_video_info_from_caps(&video_info, caps);
+        if (caps)
+            gst_caps_unref(caps);
+        if (!ok)
+            return GST_PAD_PROBE_OK;
+        generator->width = GST_VIDEO_INFO_WIDTH(&video_info);
+        generator->height = GST_VIDEO_INFO_HEIGHT(&video_info);
+        for (Object &object : generator->objects)
+            generator->Place(object);
+    } else {
+        generator->Step();
+    }
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    buffer = gst_buffer_make_writable(buffer);
+    for (size_t i = 0; i < generator->objects.size(); i++) {
+        const Object &object = generator->objects[i];
+        if (!object.present)
+            continue;
+        int x = (int)std::lround(object.x), y = (int)std::lround(object.y);
+        int w = (int)std::lround(object.w), h = (int)std::lround(object.h);
+        GstVideoRegionOfInterestMeta *meta = gst_buffer_add_video_region_of_interest_meta(buffer, "roigen", x, y, w, h);
+        GstStructure *s = gst_structure_new("roi/arsei", "obj_id", G_TYPE_INT, (gint)i, NULL);
+        if (!generator->labels.empty())
+            gst_structure_set(s, "label", G_TYPE_STRING, generator->labels[object.label].c_str(), NULL);
+        if (generator->config.conf_bits > 0)
+            gst_structure_set(s, "confidence", G_TYPE_DOUBLE, 0.5 + 0.5 * uniform(generator->random), "conf_length",
+                              G_TYPE_INT, generator->config.conf_bits, NULL);
+        gst_structure_set(s, "partial", G_TYPE_BOOLEAN,
+                          (gboolean)(x == 0 || y == 0 || x + w >= generator->width || y + h >= generator->height),
+                          NULL);
+        gst_video_region_of_interest_meta_add_param(meta, s);
+        generator->num_regions++;
+    }
+    generator->num_frames++;
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <random>
+#include <string>
+#include <vector>
+
+struct RoiGeneratorConfig {
+    // Object slots, obj_id 0 to objects - 1, all of them present in the first frame
+    int objects = 16;
+    guint seed = 1;
+    // Largest movement of an object per frame in pixels, 0 for objects standing still
+    double speed = 8.0;
+    // Probabilities per frame that a free slot gets a new object, that an object disappears
+    // and that an object changes its label
+    double appear = 0.0;
+    double disappear = 0.0;
+    double label_churn = 0.0;
+    // Distinct labels the objects take, 0 for objects without label
+    int labels = 4;
+    // Bits of the confidence the encoder writes, 0 for none
+    int conf_bits = 8;
+};
+
+// Stands in for detection and tracking when the SEI path is to be stressed without models or
+// real video: adds a GstVideoRegionOfInterestMeta with "roi/arsei" parameters (obj_id, label,
+// confidence and partial, as detect_encode sets them) for every object to the frames of a
+// raw video pad. The objects do a random walk over the frame, bouncing off the borders; the
+// sequence only depends on the seed and the frame size.
+class RoiGenerator {
+  public:
+    explicit RoiGenerator(const RoiGeneratorConfig &config);
+
+    // Installs the probe adding the regions to the buffers leaving pad, which has to carry
+    // raw video
+    void Attach(GstPad *pad);
+
+    guint64 frames() const {
+        return num_frames;
+    }
+    guint64 regions() const {
+        return num_regions;
+    }
+    // Objects that appeared or disappeared and label changes, over all frames
+    guint64 changes() const {
+        return num_changes;
+    }
+
+  private:
+    struct Object {
+        bool present = false;
+        double x, y, w, h;
+        double vx, vy;
+        int label;
+    };
+
+    static GstPadProbeReturn AddRegions(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    void Place(Object &object);
+    void Step();
+
+    RoiGeneratorConfig config;
+    std::mt19937 random;
+    std::vector<Object> objects;
+    std::vector<std::string> labels;
+    int width = 0;
+    int height = 0;
+    guint64 num_frames = 0;
+    guint64 num_regions = 0;
+    guint64 num_changes = 0;
+};
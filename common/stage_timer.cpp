@@ -0,0 +1,69 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "stage_timer.h"
+
+// Buffers an element dropped are forgotten once this many others are waiting
+#define MAX_PENDING_BUFFERS 256
+
+bool StageTimer::AddStage(GstElement *pipeline, const std::string &element_name) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name.c_str());
+    if (!element)
+        return false;
+    stages.emplace_back(new Stage());
+    Stage *stage = stages.back().get();
+    stage->name = element_name;
+
+    GstPad *sink_pad = gst_element_get_static_pad(element, "sink");
+    GstPad *src_pad = gst_element_get_static_pad(element, "src");
+    if (sink_pad && src_pad) {
+        gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, Enter, stage, NULL);
+        gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, Leave, stage, NULL);
+    }
+    if (sink_pad)
+        gst_object_unref(sink_pad);
+    if (src_pad)
+        gst_object_unref(src_pad);
+    gst_object_unref(element);
+    return true;
+}
+
+GstPadProbeReturn StageTimer::Enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Stage *stage = static_cast<Stage *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    std::lock_guard<std::mutex> lock(stage->mutex);
+    if (stage->entered.size() >= MAX_PENDING_BUFFERS)
+        stage->entered.erase(stage->entered.begin());
+    stage->entered[GST_BUFFER_PTS(buffer)] = g_get_monotonic_time();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn StageTimer::Leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    Stage *stage = static_cast<Stage *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+    std::lock_guard<std::mutex> lock(stage->mutex);
+    auto it = stage->entered.find(GST_BUFFER_PTS(buffer));
+    if (it == stage->entered.end())
+        return GST_PAD_PROBE_OK;
+    stage->total_us += g_get_monotonic_time() - it->second;
+    stage->buffers++;
+    stage->entered.erase(it);
+    return GST_PAD_PROBE_OK;
+}
+
+void StageTimer::Print() const {
+    for (const auto &stage : stages) {
+        std::lock_guard<std::mutex> lock(stage->mutex);
+        g_print("%-16s %6" G_GUINT64_FORMAT " buffers %8.3f ms per buffer\n", stage->name.c_str(), stage->buffers,
+                stage->buffers ? stage->total_us / 1000.0 / stage->buffers : 0.0);
+    }
+}
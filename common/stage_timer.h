@@ -0,0 +1,40 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Measures how long the buffers spend in single elements of a pipeline, from the sink pad to
+// the src pad, matched by timestamp. For elements that queue buffers internally, like the
+// inference elements and the encoder, this includes the time waiting there.
+class StageTimer {
+  public:
+    // Times the named element, returns false if the pipeline has no such element
+    bool AddStage(GstElement *pipeline, const std::string &element_name);
+
+    // Prints the mean time per buffer of every stage
+    void Print() const;
+
+  private:
+    struct Stage {
+        std::string name;
+        std::mutex mutex;
+        std::map<GstClockTime, gint64> entered;
+        gint64 total_us = 0;
+        guint64 buffers = 0;
+    };
+
+    static GstPadProbeReturn Enter(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn Leave(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    std::vector<std::unique_ptr<Stage>> stages;
+};
@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "tensor_view.h"
+
+// GVA::Tensor::Precision::FP32, the Inference Engine precision value
+#define TENSOR_PRECISION_FP32 10
+
+constexpr int LayerTable::LAYER_UNKNOWN;
+constexpr int LayerTable::LAYER_NONE;
+
+LayerTable::LayerTable(std::vector<std::string> layer_names) : names(std::move(layer_names)) {
+}
+
+int LayerTable::AddLayer(const std::string &layer_name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    resolved.clear();
+    names.push_back(layer_name);
+    return (int)names.size() - 1;
+}
+
+int LayerTable::Resolve(const GstStructure *param) {
+    // The inference elements name every tensor structure after its layer, so the name quark
+    // identifies the layer
+    GQuark name = gst_structure_get_name_id(param);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &entry : resolved)
+        if (entry.first == name)
+            return entry.second;
+
+    int layer = LAYER_NONE;
+    const gchar *layer_name = gst_structure_get_string(param, "layer_name");
+    gint precision = TENSOR_PRECISION_FP32;
+    gst_structure_get_int(param, "precision", &precision);
+    if (layer_name && gst_structure_has_field(param, "data_buffer") && precision == TENSOR_PRECISION_FP32) {
+        layer = LAYER_UNKNOWN;
+        for (size_t i = 0; i < names.size(); i++)
+            if (names[i] == layer_name)
+                layer = (int)i;
+    }
+    resolved.emplace_back(name, layer);
+    return layer;
+}
+
+bool LayerTable::TensorData(const GstStructure *param, TensorView &view) {
+    const GValue *value = gst_structure_get_value(param, "data_buffer");
+    if (!value || !G_VALUE_HOLDS_VARIANT(value))
+        return false;
+    gsize size = 0;
+    const void *data = g_variant_get_fixed_array(g_value_get_variant(value), &size, 1);
+    if (!data)
+        return false;
+    view.data = static_cast<const float *>(data);
+    view.size = size / sizeof(float);
+    return true;
+}
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/video/gstvideometa.h>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Output tensor of an inference layer attached to a region, without a copy. Valid while the
+// region's meta is.
+struct TensorView {
+    int layer; // index of the layer name in the LayerTable
+    const float *data;
+    size_t size;
+};
+
+// Layer names a post-processing is interested in. Tensor parameters of a region are resolved
+// to the index of their layer once per parameter name, after that finding the tensors of a
+// region compares integers only.
+class LayerTable {
+  public:
+    LayerTable() = default;
+    explicit LayerTable(std::vector<std::string> layer_names);
+
+    // Adds a layer name and returns its index, call before resolving parameters
+    int AddLayer(const std::string &layer_name);
+    size_t size() const {
+        return names.size();
+    }
+
+    // Index of the layer of a region parameter, LAYER_UNKNOWN for tensors of other layers and
+    // LAYER_NONE for parameters that aren't FP32 tensors
+    int Resolve(const GstStructure *param);
+
+    // Calls f(const TensorView &) for every tensor of a known layer attached to the region.
+    // Returns the number of tensors of the region, known layers or not.
+    template <typename F>
+    size_t ForEachTensor(GstVideoRegionOfInterestMeta *meta, F f) {
+        size_t tensors = 0;
+        for (GList *l = meta->params; l; l = l->next) {
+            const GstStructure *param = static_cast<const GstStructure *>(l->data);
+            int layer = Resolve(param);
+            if (layer == LAYER_NONE)
+                continue;
+            tensors++;
+            TensorView view;
+            if (layer != LAYER_UNKNOWN && TensorData(param, view)) {
+                view.layer = layer;
+                f(view);
+            }
+        }
+        return tensors;
+    }
+
+    static constexpr int LAYER_UNKNOWN = -1;
+    static constexpr int LAYER_NONE = -2;
+
+  private:
+    // Points the view at the data of an FP32 tensor parameter
+    static bool TensorData(const GstStructure *param, TensorView &view);
+
+    std::vector<std::string> names;
+    std::mutex mutex;
+    std::vector<std::pair<GQuark, int>> resolved;
+};
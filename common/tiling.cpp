@@ -0,0 +1,75 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "tiling.h"
+
+#include <algorithm>
+#include <numeric>
+
+// Part of a box inside a kept box above which it counts as a cut off copy
+#define CONTAINED_RATIO 0.8
+
+namespace {
+
+// Tile starts along one axis, evenly spread from 0 to size - tile
+std::vector<int> TileStarts(int size, int tile, int overlap) {
+    if (tile >= size)
+        return {0};
+    int step = std::max(tile - overlap, 1);
+    int count = (size - tile + step - 1) / step + 1;
+    std::vector<int> starts(count);
+    for (int i = 0; i < count; i++)
+        starts[i] = (int)((long long)i * (size - tile) / (count - 1));
+    return starts;
+}
+
+} // namespace
+
+std::vector<FrameRegion> TileFrame(int width, int height, int tile_width, int tile_height, int overlap) {
+    tile_width = std::min(tile_width, width);
+    tile_height = std::min(tile_height, height);
+    std::vector<FrameRegion> tiles;
+    for (int y : TileStarts(height, tile_height, overlap))
+        for (int x : TileStarts(width, tile_width, overlap))
+            tiles.push_back({x, y, tile_width, tile_height});
+    return tiles;
+}
+
+std::vector<size_t> SuppressOverlaps(const std::vector<FrameRegion> &boxes, const std::vector<double> &scores,
+                                     double iou_threshold) {
+    std::vector<size_t> order(boxes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scores[a] > scores[b]; });
+
+    std::vector<size_t> kept;
+    for (size_t i : order) {
+        const FrameRegion &box = boxes[i];
+        double area = double(box.w) * box.h;
+        bool suppressed = false;
+        for (size_t &k : kept) {
+            const FrameRegion &other = boxes[k];
+            int x0 = std::max(box.x, other.x), y0 = std::max(box.y, other.y);
+            int x1 = std::min(box.x + box.w, other.x + other.w), y1 = std::min(box.y + box.h, other.y + other.h);
+            if (x1 <= x0 || y1 <= y0)
+                continue;
+            double inter = double(x1 - x0) * (y1 - y0);
+            double other_area = double(other.w) * other.h;
+            // The kept box is the cut off copy of this one
+            if (inter > CONTAINED_RATIO * other_area && area > other_area) {
+                k = i;
+                suppressed = true;
+                break;
+            }
+            if (inter / (area + other_area - inter) > iou_threshold || inter > CONTAINED_RATIO * area) {
+                suppressed = true;
+                break;
+            }
+        }
+        if (!suppressed)
+            kept.push_back(i);
+    }
+    return kept;
+}
@@ -0,0 +1,23 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "motion_detector.h"
+
+// Tiles of tile_width x tile_height (or the frame size if smaller) that cover the frame and
+// overlap their neighbours by at least overlap pixels, row by row
+std::vector<FrameRegion> TileFrame(int width, int height, int tile_width, int tile_height, int overlap);
+
+// Non-maximum suppression across tiles. Returns the indices of the boxes to keep. A box is
+// dropped if it overlaps a box with a higher score with an IoU above iou_threshold. A face
+// cut at a tile edge leaves a partial box there next to the whole one from the neighbouring
+// tile, of two boxes where most of one lies inside the other the larger one is kept.
+std::vector<size_t> SuppressOverlaps(const std::vector<FrameRegion> &boxes, const std::vector<double> &scores,
+                                     double iou_threshold);
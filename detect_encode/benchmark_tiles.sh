@@ -0,0 +1,39 @@
+#!/bin/bash
+# ==============================================================================
+# Copyright (C) 2020 Intel Corporation
+#
+# SPDX-License-Identifier: MIT
+# ==============================================================================
+
+# Compares full frame and tiled detection on an upscaled copy of a bundled clip.
+# Run ./build_and_run.sh once before, so that build/detect_encode exists.
+# Usage: ./benchmark_tiles.sh [CLIP.h264] [WIDTH] [HEIGHT] [FRAMES]
+
+set -e
+
+BASE_DIR=$PWD
+BUILD_DIR=$BASE_DIR/build
+CLIP=${1:-$BASE_DIR/../playback/input/head-pose-face-detection-female-and-male_768x432_30p_300f.h264}
+WIDTH=${2:-3840}
+HEIGHT=${3:-2160}
+FRAMES=${4:-100}
+
+WORK_DIR=$(mktemp -d)
+trap "rm -rf ${WORK_DIR}" EXIT
+RAW=${WORK_DIR}/upscaled_${WIDTH}x${HEIGHT}.yuv
+
+# The faces keep their size relative to the frame, so they are small at 4K
+gst-launch-1.0 -q filesrc location=${CLIP} ! h264parse ! msdkh264dec ! videoconvert ! videoscale ! \
+    video/x-raw,format=I420,width=${WIDTH},height=${HEIGHT} ! identity eos-after=${FRAMES} ! \
+    filesink location=${RAW}
+
+for MODE in frame tiles; do
+    echo "== ${MODE}"
+    if [ ${MODE} == frame ]; then
+        BOXES="--box-log ${WORK_DIR}/boxes_frame.txt"
+    else
+        BOXES="--box-reference ${WORK_DIR}/boxes_frame.txt"
+    fi
+    ${BUILD_DIR}/detect_encode -i ${RAW} --width ${WIDTH} --height ${HEIGHT} -c h264 -n \
+        --detect-regions ${MODE} ${BOXES} | grep -E "^(Detection|Boxes)"
+done
@@ -5,14 +5,26 @@
  ******************************************************************************/
 
 #include <algorithm>
+#include <atomic>
 #include <dirent.h>
 #include <gio/gio.h>
 #include <gst/gst.h>
+#include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 
+#include "box_log.h"
+#include "box_smoother.h"
 #include "gst/videoanalytics/video_frame.h"
+#include "job_server.h"
+#include "metrics_server.h"
+#include "model_index.h"
+#include "motion_detector.h"
+#include "pipeline_stats.h"
+#include "tiling.h"
 
 using namespace std;
 
@@ -20,72 +32,15 @@ gchar const *comp_scheme = NULL;
 
 #define UNUSED(x) (void)(x)
 
-#define ENABLE_ARSEI_INSERTION 1
+// Overridden with -DENABLE_ARSEI_INSERTION=0|1 by the pipeline benchmarks
+#ifndef ENABLE_ARSEI_INSERTION
+  #define ENABLE_ARSEI_INSERTION 1
+#endif
 
 #if ENABLE_ARSEI_INSERTION
   #define ARSEI_INSERT_LABEL 0
 #endif
 
-std::vector<std::string> SplitString(const std::string input, char delimiter = ':') {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(input);
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
-    }
-    return tokens;
-}
-
-void ExploreDir(std::string search_dir, const std::string &model_name, std::vector<std::string> &result) {
-    if (auto dir_handle = opendir(search_dir.c_str())) {
-        while (auto file_handle = readdir(dir_handle)) {
-            if ((!file_handle->d_name) || (file_handle->d_name[0] == '.'))
-                continue;
-            if (file_handle->d_type == DT_DIR)
-                ExploreDir(search_dir + file_handle->d_name + "/", model_name, result);
-            if (file_handle->d_type == DT_REG) {
-                std::string name(file_handle->d_name);
-                if (name == model_name)
-                    result.push_back(search_dir + "/" + name);
-            }
-        }
-        closedir(dir_handle);
-    }
-}
-
-std::vector<std::string> FindModel(const std::vector<std::string> &search_dirs, const std::string &model_name) {
-    std::vector<std::string> result = {};
-    for (std::string dir : search_dirs) {
-        ExploreDir(dir + "/", model_name, result);
-    }
-    return result;
-}
-
-std::string to_upper_case(std::string str) {
-    std::transform(str.begin(), str.end(), str.begin(), ::toupper);
-    return str;
-}
-
-std::map<std::string, std::string> FindModels(const std::vector<std::string> &search_dirs,
-                                              const std::vector<std::string> &model_names,
-                                              const std::string &precision) {
-    std::map<std::string, std::string> result;
-    for (std::string model_name : model_names) {
-        std::vector<std::string> model_paths = FindModel(search_dirs, model_name);
-        if (model_paths.empty())
-            throw std::runtime_error("Can't find file for model: " + model_name);
-        result[model_name] = model_paths.front();
-        // The path to the model must contain the precision (/FP32/ or /INT8/)
-        for (auto &model_path : model_paths)
-            // TODO extract precision from xml file
-            if (to_upper_case(model_path).find(to_upper_case(precision)) != std::string::npos) {
-                result[model_name] = model_path;
-                break;
-            }
-    }
-    return result;
-}
-
 const std::string env_models_path =
     std::string() + (getenv("MODELS_PATH") != NULL
                          ? getenv("MODELS_PATH")
@@ -98,23 +53,99 @@ gchar const *detection_model = NULL;
 gchar const *extension = NULL;
 gchar const *device = "CPU";
 gchar const *model_precision = "FP32";
-gint batch_size = 1;
+gint batch_size = 0;
 gdouble threshold = 0.4;
 gboolean no_display = FALSE;
+gint box_grid = 1;
+gdouble box_alpha = 1.0;
+gint box_hysteresis = 0;
+gint conf_bits = 8;
+gchar const *server_socket = NULL;
+gchar const *spool_dir = NULL;
+gint workers = 1;
+gboolean streams = FALSE;
+gint detect_interval = 1;
+gchar const *box_log_file = NULL;
+gchar const *box_reference_file = NULL;
+// Boxes and frames seen by the AR SEI probe, only for a single input
+BoxLog *box_log = NULL;
+std::atomic<guint64> frames_encoded(0);
+gchar const *stats_file = NULL;
+gint stats_interval = 0;
+// Latencies of all pipelines, with --stats
+PipelineStats *pipeline_stats = NULL;
+gchar const *metrics_address = NULL;
+// Live counters of all pipelines, with --metrics
+MetricsServer *metrics_server = NULL;
+gint static_threshold = 0;
+gchar const *detect_regions = "frame";
+gint input_width = 768;
+gint input_height = 432;
+// Input size of face-detection-adas-0001
+gint tile_width = 672;
+gint tile_height = 384;
+gint tile_overlap = 64;
 const std::vector<std::string> default_detection_model_names = {"face-detection-adas-0001.xml"};
 
 // This structure will be used to pass user data (such as memory type) to the
 // callback function.
 static GOptionEntry opt_entries[] = {
-    {"input", 'i', 0, G_OPTION_ARG_STRING, &input_file, "Path to input (raw yuv) video file", NULL},
+    {"input", 'i', 0, G_OPTION_ARG_STRING, &input_file,
+     "Path to input (raw yuv) video file, or a ',' separated list of files and glob patterns", NULL},
     {"compression", 'c', 0, G_OPTION_ARG_STRING, &comp_scheme, "Compression scheme of input file", NULL},    
     {"precision", 'p', 0, G_OPTION_ARG_STRING, &model_precision, "Models precision. Default: FP32", NULL},
     {"detection", 'm', 0, G_OPTION_ARG_STRING, &detection_model, "Path to detection model file", NULL},    
     {"extension", 'e', 0, G_OPTION_ARG_STRING, &extension, "Path to custom layers extension library", NULL},
     {"device", 'd', 0, G_OPTION_ARG_STRING, &device, "Device to run inference", NULL},
-    {"batch", 'b', 0, G_OPTION_ARG_INT, &batch_size, "Batch size", NULL},
+    {"batch", 'b', 0, G_OPTION_ARG_INT, &batch_size,
+     "Batch size. Default: 1, the number of inputs with --streams or the tiles per frame with --detect-regions tiles",
+     NULL},
     {"threshold", 't', 0, G_OPTION_ARG_DOUBLE, &threshold, "Confidence threshold for detection (0 - 1)", NULL},
     {"no-display", 'n', 0, G_OPTION_ARG_NONE, &no_display, "Run without display", NULL},
+    {"box-grid", 0, 0, G_OPTION_ARG_INT, &box_grid, "Snap AR SEI boxes to a grid of this many pixels. Default: 1",
+     NULL},
+    {"box-alpha", 0, 0, G_OPTION_ARG_DOUBLE, &box_alpha,
+     "Smoothing factor for AR SEI boxes (0 - 1), 1 disables smoothing. Default: 1", NULL},
+    {"box-hysteresis", 0, 0, G_OPTION_ARG_INT, &box_hysteresis,
+     "Pixels a box edge has to move before the AR SEI box is updated. Default: 0", NULL},
+    {"conf-bits", 0, 0, G_OPTION_ARG_INT, &conf_bits,
+     "Bits for the AR SEI object confidence (1 - 16), 0 leaves it out. Default: 8", NULL},
+    {"server", 0, 0, G_OPTION_ARG_STRING, &server_socket,
+     "Keep the pipelines loaded and take jobs from this UNIX socket", NULL},
+    {"spool", 0, 0, G_OPTION_ARG_STRING, &spool_dir, "Keep the pipelines loaded and take jobs from *.job files in this directory",
+     NULL},
+    {"workers", 'w', 0, G_OPTION_ARG_INT, &workers,
+     "Pipelines running in parallel when several inputs are given, 0 for one per core. Default: 1", NULL},
+    {"streams", 's', 0, G_OPTION_ARG_NONE, &streams,
+     "Process several inputs at the same time in one pipeline, batching inference across the streams", NULL},
+    {"detect-interval", 0, 0, G_OPTION_ARG_INT, &detect_interval,
+     "Run detection on every Nth frame only, the tracker moves the boxes in between. Default: 1", NULL},
+    {"box-log", 0, 0, G_OPTION_ARG_STRING, &box_log_file, "Write the boxes of every frame to this file", NULL},
+    {"box-reference", 0, 0, G_OPTION_ARG_STRING, &box_reference_file,
+     "Compare the boxes against a --box-log file, e.g. of a run with --detect-interval 1", NULL},
+    {"static-threshold", 0, 0, G_OPTION_ARG_INT, &static_threshold,
+     "Skip detection on frames where no 16x16 luma block changed by more than this many levels since the last "
+     "detection, 0 detects on every frame. Default: 0",
+     NULL},
+    {"detect-regions", 0, 0, G_OPTION_ARG_STRING, &detect_regions,
+     "Where to detect: frame (the whole frame), motion (only around blocks that changed since the last "
+     "detection) or tiles (overlapping tiles of the detector input size, as one batch). Default: frame",
+     NULL},
+    {"tile-width", 0, 0, G_OPTION_ARG_INT, &tile_width, "Tile width for --detect-regions tiles. Default: 672", NULL},
+    {"tile-height", 0, 0, G_OPTION_ARG_INT, &tile_height, "Tile height for --detect-regions tiles. Default: 384",
+     NULL},
+    {"tile-overlap", 0, 0, G_OPTION_ARG_INT, &tile_overlap,
+     "Pixels neighbouring tiles overlap at least, should be above the size of a face. Default: 64", NULL},
+    {"width", 0, 0, G_OPTION_ARG_INT, &input_width, "Width of the raw input. Default: 768", NULL},
+    {"height", 0, 0, G_OPTION_ARG_INT, &input_height, "Height of the raw input. Default: 432", NULL},
+    {"stats", 0, 0, G_OPTION_ARG_STRING, &stats_file,
+     "Write per-element latencies, queue levels, frame latency and fps as JSON to this file ('-' for stdout)",
+     NULL},
+    {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval,
+     "Rewrite the --stats file every that many seconds while running (0: at the end only)", NULL},
+    {"metrics", 0, 0, G_OPTION_ARG_STRING, &metrics_address,
+     "Serve Prometheus metrics over HTTP on [host:]port (host defaults to 127.0.0.1) or on a UNIX socket path",
+     NULL},
     GOptionEntry()};
 
 #if ENABLE_ARSEI_INSERTION
@@ -122,7 +153,7 @@ static GOptionEntry opt_entries[] = {
 // Printing classification results on a frame
 // Gets called to notify about the current blocking type
 static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    UNUSED(user_data);
+    BoxSmoother *box_smoother = static_cast<BoxSmoother *>(user_data);
 
     // Create buffer with data from GstPadProbeInfo
     auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
@@ -164,15 +195,34 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
         rmeta = roi._meta();
         object_id = roi.object_id();
         //std::cout<<object_id<<"\t"<<rect.x<<"\t"<<rect.y<<std::endl;
-        if (rmeta == NULL)
+        if (rmeta == NULL) {
           std::cout<<"Null pointer"<<std::endl;
+          continue;
+        }
+        // Stabilize the box so the encoder can skip unchanged objects
+        if (box_smoother->enabled()) {
+          SmoothedBox box = box_smoother->Apply(object_id, rect.x, rect.y, rect.w, rect.h);
+          rmeta->x = box.x;
+          rmeta->y = box.y;
+          rmeta->w = box.w;
+          rmeta->h = box.h;
+        }
 #if ARSEI_INSERT_LABEL
         s = gst_structure_new ("roi/arsei", "obj_id", G_TYPE_INT, roi.object_id()-1, "label", G_TYPE_STRING, "face", NULL);
 #else
         s = gst_structure_new ("roi/arsei", "obj_id", G_TYPE_INT, roi.object_id()-1, NULL);
 #endif
+        if (conf_bits > 0)
+          gst_structure_set (s, "confidence", G_TYPE_DOUBLE, roi.confidence(), "conf_length", G_TYPE_INT, conf_bits, NULL);
+        // Boxes touching the frame border only show part of the object
+        gst_structure_set (s, "partial", G_TYPE_BOOLEAN,
+                           (gboolean)(rect.x == 0 || rect.y == 0 || (gint)(rect.x + rect.w) >= width ||
+                                      (gint)(rect.y + rect.h) >= height),
+                           NULL);
         gst_video_region_of_interest_meta_add_param (rmeta, s);
     }
+    if (box_smoother->enabled())
+        box_smoother->EndFrame();
 
     // Release the memory previously mapped with gst_buffer_map
     gst_buffer_unmap(buffer, &map);
@@ -184,6 +234,451 @@ static GstPadProbeReturn pad_probe_callback(GstPad *pad, GstPadProbeInfo *info,
 }
 #endif
 
+// Label of the regions the application hands to gvadetect, removed again after detection
+#define DETECT_REGION_LABEL "detect-region"
+// Pixels added around changed blocks, so that a moving face is inside the region as a whole
+#define MOTION_REGION_MARGIN 32
+// Smallest motion region, smaller ones would only be upscaled for the detector
+#define MOTION_REGION_MIN_SIZE 128
+// Motion regions covering more than this part of the frame are replaced by the frame
+#define MOTION_REGION_MAX_COVERAGE 0.6
+// IoU above which boxes of neighbouring tiles are the same face
+#define TILE_NMS_IOU 0.4
+
+static bool motion_regions() {
+    return g_strcmp0(detect_regions, "motion") == 0;
+}
+
+static bool tiled_regions() {
+    return g_strcmp0(detect_regions, "tiles") == 0;
+}
+
+// True if the application chooses the regions gvadetect runs on
+static bool gated_detection() {
+    return static_threshold > 0 || motion_regions() || tiled_regions();
+}
+
+// Chooses the parts of every frame gvadetect runs on (inference-region=roi-list). Frames
+// without change since the last detection get no region and are not inferred. With motion
+// regions only the parts around the changed blocks are, with tiles the frame is split into
+// overlapping tiles. Detections of earlier frames outside the inferred regions are carried
+// forward unchanged, so the tracker keeps the IDs and the AR SEI has nothing to update for
+// them.
+struct DetectionGate {
+    struct Detection {
+        int x, y, w, h;
+        std::string label;
+        double confidence;
+    };
+
+    MotionDetector motion{static_threshold};
+    std::mutex mutex;
+    std::vector<Detection> previous;
+    guint64 frames = 0;
+    guint64 inferred = 0;
+    double inferred_area = 0; // sum of the inferred parts of the frames
+
+    bool enabled() const {
+        return gated_detection();
+    }
+    // Forgets the last frame and its detections, for the start of a new input
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        motion = MotionDetector(static_threshold);
+        previous.clear();
+    }
+};
+
+// In front of gvadetect: adds the regions to detect on
+static GstPadProbeReturn detect_region_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    DetectionGate *gate = static_cast<DetectionGate *>(user_data);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer == NULL)
+        return GST_PAD_PROBE_OK;
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+        throw std::runtime_error("Can't get current caps");
+    GVA::VideoFrame video_frame(buffer, caps);
+    auto video_info = video_frame.video_info();
+    gint width = video_info->width;
+    gint height = video_info->height;
+
+    // NV12, the luma plane comes first
+    bool changed = true;
+    if (gate->motion.enabled()) {
+        GstMapInfo map;
+        if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            gst_caps_unref(caps);
+            return GST_PAD_PROBE_OK;
+        }
+        changed = gate->motion.Compare(map.data + GST_VIDEO_INFO_PLANE_OFFSET(video_info, 0), width, height,
+                                       GST_VIDEO_INFO_PLANE_STRIDE(video_info, 0));
+        gst_buffer_unmap(buffer, &map);
+    }
+
+    gate->frames++;
+    if (changed) {
+        gate->motion.Accept();
+        gate->inferred++;
+        std::vector<FrameRegion> regions;
+        double area = 0;
+        if (motion_regions())
+            regions = gate->motion.ChangedRegions(width, height, MOTION_REGION_MARGIN, MOTION_REGION_MIN_SIZE);
+        else if (tiled_regions())
+            regions = TileFrame(width, height, tile_width, tile_height, tile_overlap);
+        for (const auto &region : regions)
+            area += double(region.w) * region.h / (double(width) * height);
+        if (regions.empty() || (motion_regions() && area > MOTION_REGION_MAX_COVERAGE)) {
+            regions = {{0, 0, width, height}};
+            area = 1.0;
+        }
+        gate->inferred_area += area;
+        for (const auto &region : regions)
+            video_frame.add_region(region.x, region.y, region.w, region.h, DETECT_REGION_LABEL, 1.0);
+    }
+    gst_caps_unref(caps);
+    return GST_PAD_PROBE_OK;
+}
+
+// Behind gvadetect: removes the regions added in front of it and carries the detections
+// forward to the parts of the frame that were not inferred
+static GstPadProbeReturn detect_result_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    DetectionGate *gate = static_cast<DetectionGate *>(user_data);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer == NULL)
+        return GST_PAD_PROBE_OK;
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+        throw std::runtime_error("Can't get current caps");
+    GVA::VideoFrame video_frame(buffer, caps);
+    std::vector<FrameRegion> regions;
+    std::vector<GVA::RegionOfInterest> rois;
+    std::vector<FrameRegion> boxes;
+    std::vector<double> scores;
+    for (GVA::RegionOfInterest &roi : video_frame.regions()) {
+        auto rect = roi.rect();
+        if (roi.label() == DETECT_REGION_LABEL) {
+            regions.push_back({(int)rect.x, (int)rect.y, (int)rect.w, (int)rect.h});
+            video_frame.remove_region(roi);
+            continue;
+        }
+        rois.push_back(roi);
+        boxes.push_back({(int)rect.x, (int)rect.y, (int)rect.w, (int)rect.h});
+        scores.push_back(roi.confidence());
+    }
+
+    // Faces in the overlap of regions are detected more than once
+    std::vector<bool> keep(rois.size(), regions.size() <= 1);
+    if (regions.size() > 1)
+        for (size_t i : SuppressOverlaps(boxes, scores, TILE_NMS_IOU))
+            keep[i] = true;
+    std::vector<DetectionGate::Detection> detections;
+    for (size_t i = 0; i < rois.size(); i++) {
+        if (!keep[i]) {
+            video_frame.remove_region(rois[i]);
+            continue;
+        }
+        detections.push_back({boxes[i].x, boxes[i].y, boxes[i].w, boxes[i].h, rois[i].label(), scores[i]});
+    }
+
+    std::lock_guard<std::mutex> lock(gate->mutex);
+    for (const auto &detection : gate->previous) {
+        int cx = detection.x + detection.w / 2, cy = detection.y + detection.h / 2;
+        bool inferred = std::any_of(regions.begin(), regions.end(), [&](const FrameRegion &region) {
+            return cx >= region.x && cx < region.x + region.w && cy >= region.y && cy < region.y + region.h;
+        });
+        if (inferred)
+            continue;
+        video_frame.add_region(detection.x, detection.y, detection.w, detection.h, detection.label.c_str(),
+                               detection.confidence);
+        detections.push_back(detection);
+    }
+    gate->previous.swap(detections);
+    gst_caps_unref(caps);
+    return GST_PAD_PROBE_OK;
+}
+
+// Adds the probes of the gate around the named gvadetect, gate has to outlive them
+static void add_detection_gate(GstElement *pipeline, const std::string &detect_name, DetectionGate *gate) {
+    if (!gate->enabled())
+        return;
+    auto detect = gst_bin_get_by_name(GST_BIN(pipeline), detect_name.c_str());
+    auto sink_pad = gst_element_get_static_pad(detect, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, detect_region_probe_callback, gate, NULL);
+    gst_object_unref(sink_pad);
+    auto src_pad = gst_element_get_static_pad(detect, "src");
+    gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, detect_result_probe_callback, gate, NULL);
+    gst_object_unref(src_pad);
+    gst_object_unref(detect);
+}
+
+static void print_detection_stats(const std::vector<const DetectionGate *> &gates) {
+    guint64 frames = 0, inferred = 0;
+    double inferred_area = 0;
+    for (const DetectionGate *gate : gates) {
+        frames += gate->frames;
+        inferred += gate->inferred;
+        inferred_area += gate->inferred_area;
+    }
+    if (!gates.empty() && gates[0]->enabled())
+        g_print("Detection ran on %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+                " frames, on %.1f%% of the frame area on average\n",
+                inferred, frames, frames ? 100.0 * inferred_area / frames : 0.0);
+}
+
+static gchar const *video_source_for(const std::string &input_str) {
+    if (input_str.find("/dev/video") != std::string::npos) {
+        return "v4l2src device";
+    } else if (input_str.find("://") != std::string::npos) {
+        return "urisourcebin buffer-size=4096 uri";
+    }
+    return "filesrc location";
+}
+
+static std::string encoder_str(gboolean h264_compression_scheme, const std::string &name) {
+    if (h264_compression_scheme == FALSE)
+        return "msdkh265enc name=" + name + " rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
+    return "msdkh264enc name=" + name + " rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
+}
+
+// Source, detection, tracking and encoding of one stream. The model instance is shared by
+// all streams and pipelines of the process, instance_users of them run at the same time.
+static std::string stream_str(gchar const *video_source, gchar const *input, gboolean h264_compression_scheme,
+                              const std::string &detect_name, const std::string &encoder_name, gchar const *sink,
+                              gint instance_users) {
+    auto launch_str = g_strdup_printf("%s=%s num_buffers=300 !"
+                                      " rawvideoparse format=i420 width=%d height=%d ! videoconvert ! video/x-raw,format=NV12 !"
+                                      " gvadetect name=%s model=%s device=%s batch-size=%d inference-interval=%d%s model-instance-id=detect%s !"
+                                      " %s ! %s ! %s",
+                                      video_source, input, input_width, input_height, detect_name.c_str(), detection_model,
+                                      device, batch_size, detect_interval,
+                                      // The detection gate chooses the regions
+                                      gated_detection() ? " inference-region=roi-list" : "",
+                                      SharedInstanceOptions(instance_users, device).c_str(),
+                                      // Only the short-term tracker predicts boxes on frames without detection
+                                      detect_interval > 1 ? "gvatrack tracking-type=short-term" : "gvatrack",
+                                      encoder_str(h264_compression_scheme, encoder_name).c_str(), sink);
+    std::string str = launch_str;
+    g_free(launch_str);
+    return str;
+}
+
+// Counts the frames reaching the encoder and logs their boxes, with or without AR SEI
+static GstPadProbeReturn frame_probe_callback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    UNUSED(pad);
+    UNUSED(user_data);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (buffer == NULL)
+        return GST_PAD_PROBE_OK;
+    if (box_log) {
+        gpointer state = NULL;
+        GstMeta *meta;
+        while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+            auto roi = reinterpret_cast<GstVideoRegionOfInterestMeta *>(meta);
+            box_log->Add(GST_BUFFER_PTS(buffer), {(int)roi->x, (int)roi->y, (int)roi->w, (int)roi->h});
+        }
+    }
+    frames_encoded++;
+    return GST_PAD_PROBE_OK;
+}
+
+// Adds the frame probe and the AR SEI probe to the sink pad of the named encoder, box_smoother
+// has to outlive it
+static void add_encoder_probes(GstElement *pipeline, const std::string &encoder_name, BoxSmoother *box_smoother) {
+    auto encoder = gst_bin_get_by_name(GST_BIN(pipeline), encoder_name.c_str());
+    auto pad = gst_element_get_static_pad(encoder, "sink");
+    // Ahead of the AR SEI probe, so that the box log gets the boxes before smoothing
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, frame_probe_callback, NULL, NULL);
+#if ENABLE_ARSEI_INSERTION
+    // The provided callback 'pad_probe_callback' is called for every state that
+    // matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, box_smoother, NULL);
+#else
+    UNUSED(box_smoother);
+#endif
+    gst_object_unref(pad);
+    gst_object_unref(encoder);
+}
+
+// Builds the detect and encode pipeline, box_smoother and gate have to outlive it
+static GstElement *create_pipeline(gchar const *video_source, gchar const *input, gboolean h264_compression_scheme,
+                                   gchar const *sink, BoxSmoother *box_smoother, DetectionGate *gate) {
+    std::string encoder_name = h264_compression_scheme ? "msdkh264enc" : "msdkh265enc";
+    std::string launch_str =
+        stream_str(video_source, input, h264_compression_scheme, "detect", encoder_name, sink, workers);
+
+    g_print("PIPELINE: %s \n", launch_str.c_str());
+    GstElement *pipeline = gst_parse_launch(launch_str.c_str(), NULL);
+    add_detection_gate(pipeline, "detect", gate);
+    add_encoder_probes(pipeline, encoder_name, box_smoother);
+    if (pipeline_stats)
+        pipeline_stats->Attach(pipeline);
+    if (metrics_server)
+        metrics_server->Attach(pipeline, {{"detect", {"detect"}, encoder_name, !h264_compression_scheme}});
+    return pipeline;
+}
+
+// Builds one pipeline with a branch per input. All gvadetect elements share one model
+// instance, which fills its batches with frames of all streams. Every branch has its own
+// encoder, AR SEI probe and output file.
+static GstElement *create_streams_pipeline(const std::vector<std::string> &inputs, gboolean h264_compression_scheme,
+                                           std::vector<std::unique_ptr<BoxSmoother>> &box_smoothers,
+                                           std::vector<std::unique_ptr<DetectionGate>> &gates) {
+    std::string launch_str;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        gchar *base = g_path_get_basename(inputs[i].c_str());
+        std::string sink = std::string("filesink location=output/") + base + (h264_compression_scheme ? ".h264" : ".h265");
+        g_free(base);
+        launch_str += stream_str(video_source_for(inputs[i]), inputs[i].c_str(), h264_compression_scheme,
+                                 "detect" + std::to_string(i), "enc" + std::to_string(i), sink.c_str(),
+                                 (gint)inputs.size()) +
+                      " ";
+    }
+
+    g_print("PIPELINE: %s \n", launch_str.c_str());
+    GstElement *pipeline = gst_parse_launch(launch_str.c_str(), NULL);
+    std::vector<MetricsTaps> metrics_taps;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        std::string detect_name = "detect" + std::to_string(i);
+        metrics_taps.push_back({detect_name, {detect_name}, "enc" + std::to_string(i), !h264_compression_scheme});
+        box_smoothers.emplace_back(new BoxSmoother(box_grid, box_alpha, box_hysteresis));
+        add_encoder_probes(pipeline, "enc" + std::to_string(i), box_smoothers.back().get());
+        gates.emplace_back(new DetectionGate());
+        add_detection_gate(pipeline, "detect" + std::to_string(i), gates.back().get());
+    }
+    if (pipeline_stats)
+        pipeline_stats->Attach(pipeline);
+    if (metrics_server)
+        metrics_server->Attach(pipeline, metrics_taps);
+    return pipeline;
+}
+
+static void print_box_stats(const std::vector<const BoxSmoother *> &box_smoothers) {
+#if ENABLE_ARSEI_INSERTION
+    guint64 boxes = 0;
+    double iou_sum = 0;
+    for (const BoxSmoother *box_smoother : box_smoothers) {
+        boxes += box_smoother->boxes();
+        iou_sum += box_smoother->MeanIoU() * box_smoother->boxes();
+    }
+    if (!box_smoothers.empty() && box_smoothers[0]->enabled())
+        g_print("AR SEI box smoothing: %" G_GUINT64_FORMAT " boxes, mean IoU against detector boxes %.4f\n", boxes,
+                boxes ? iou_sum / boxes : 0.0);
+#else
+    UNUSED(box_smoothers);
+#endif
+}
+
+static double cpu_seconds(const struct rusage &usage) {
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Throughput of the run and, with a reference box log, the accuracy of the boxes
+static void print_run_report(gint64 elapsed_us, const struct rusage &usage_start) {
+    struct rusage usage_end;
+    getrusage(RUSAGE_SELF, &usage_end);
+    guint64 frames = frames_encoded;
+    double seconds = elapsed_us / 1e6;
+    g_print("Detection every %d frame(s): %" G_GUINT64_FORMAT " frames in %.2f s (%.1f fps), %.2f ms CPU per frame\n",
+            detect_interval, frames, seconds, seconds > 0 ? frames / seconds : 0.0,
+            frames ? (cpu_seconds(usage_end) - cpu_seconds(usage_start)) * 1000 / frames : 0.0);
+    if (!box_log)
+        return;
+    if (box_log_file && !box_log->Save(box_log_file))
+        g_printerr("Can't write %s\n", box_log_file);
+    if (box_reference_file) {
+        BoxLog reference;
+        if (!reference.Load(box_reference_file)) {
+            g_printerr("Can't read %s\n", box_reference_file);
+            return;
+        }
+        BoxAccuracy accuracy = box_log->Compare(reference);
+        g_print("Boxes against %s: recall %.3f, precision %.3f, mean IoU %.3f over %" G_GUINT64_FORMAT " frames\n",
+                box_reference_file, accuracy.recall(), accuracy.precision(), accuracy.mean_iou,
+                (guint64)accuracy.frames);
+    }
+}
+
+// Pipelines of one job worker, one per output codec
+struct JobWorker {
+    BoxSmoother box_smoother{box_grid, box_alpha, box_hysteresis};
+    DetectionGate gate;
+    std::map<std::string, std::unique_ptr<ReusablePipeline>> pipelines;
+
+    // Runs a job "input=<raw yuv file> [codec=h264|h265] [output=<file>]"
+    bool Run(const Job &job, std::string &error) {
+        auto input = job.find("input");
+        if (input == job.end()) {
+            error = "job has no input";
+            return false;
+        }
+        auto codec_it = job.find("codec");
+        std::string codec = codec_it != job.end() ? codec_it->second : (comp_scheme ? comp_scheme : "h265");
+        if (codec != "h264" && codec != "h265") {
+            error = "unsupported codec " + codec;
+            return false;
+        }
+        auto output_it = job.find("output");
+        std::string output;
+        if (output_it != job.end()) {
+            output = output_it->second;
+        } else {
+            gchar *base = g_path_get_basename(input->second.c_str());
+            output = std::string("output/") + base + "." + codec;
+            g_free(base);
+        }
+
+        auto &pipeline = pipelines[codec];
+        if (!pipeline || pipeline->broken()) {
+            pipeline.reset();
+            pipeline.reset(new ReusablePipeline(create_pipeline("filesrc name=src location", input->second.c_str(),
+                                                                codec == "h264", "filesink name=sink async=false location=/dev/null",
+                                                                &box_smoother, &gate)));
+        }
+        gate.Reset();
+        box_smoother.Reset();
+        return pipeline->Run(input->second, output, error);
+    }
+};
+
+// Runs the given inputs on a pool of workers whose pipelines stay loaded between jobs, or
+// serves jobs from the job server if there are none
+static int run_jobs(const std::vector<std::string> &inputs) {
+    std::vector<std::unique_ptr<JobWorker>> job_workers;
+    std::mutex job_workers_mutex;
+    JobHandlerFactory make_handler = [&]() -> JobHandler {
+        std::lock_guard<std::mutex> lock(job_workers_mutex);
+        job_workers.emplace_back(new JobWorker());
+        JobWorker *job_worker = job_workers.back().get();
+        return [job_worker](const Job &job, std::string &error) { return job_worker->Run(job, error); };
+    };
+
+    int ret_code;
+    if (inputs.empty()) {
+        ret_code = RunJobServer(server_socket, spool_dir, make_handler());
+    } else {
+        std::vector<Job> jobs;
+        for (const auto &input : inputs)
+            jobs.push_back({{"input", input}});
+        ret_code = RunJobPool(jobs, workers, make_handler);
+    }
+
+    std::vector<const BoxSmoother *> box_smoothers;
+    std::vector<const DetectionGate *> gates;
+    for (auto &job_worker : job_workers) {
+        job_worker->pipelines.clear();
+        box_smoothers.push_back(&job_worker->box_smoother);
+        gates.push_back(&job_worker->gate);
+    }
+    print_box_stats(box_smoothers);
+    print_detection_stats(gates);
+    if (pipeline_stats && !pipeline_stats->Write())
+        g_printerr("Can't write statistics to %s\n", stats_file);
+    return ret_code;
+}
+
 // Sample recieves video with faces as an argument
 // If video file is not passed as an argument obviously, an attempt will be made
 // to use camera
@@ -202,21 +697,8 @@ int main(int argc, char *argv[]) {
     // Construct the pipeline
     // If video file is not passed as an argument, an attempt will be made to use
     // camera
-    gchar const *video_source = NULL;
-    std::string input_str;
-    if (input_file) {
-        input_str = (input_file);
-        if (input_str.find("/dev/video") != std::string::npos) {
-            video_source = "v4l2src device";
-        } else if (input_str.find("://") != std::string::npos) {
-            video_source = "urisourcebin buffer-size=4096 uri";
-        } else {
-            video_source = "filesrc location";
-        }
-    } else {
+    if (!input_file)
         input_file = "/dev/video0";
-        video_source = "v4l2src device";
-    }
     
    
     // Compression scheme of the output file
@@ -245,61 +727,98 @@ int main(int argc, char *argv[]) {
         detection_model = g_strdup(model_paths["face-detection-adas-0001.xml"].c_str());
     }    
 
-    gchar const *preprocess_pipeline = "rawvideoparse format=i420 width=768 height=432 ! videoconvert ! video/x-raw,format=NV12";
-    gchar const *enc_str;
+    std::vector<std::string> inputs = ExpandInputList(input_file);
+    // A list or pattern with a single match runs like that file
+    if (inputs.size() == 1)
+        input_file = inputs[0].c_str();
+    gchar const *video_source = video_source_for(input_file);
+    gboolean multi_stream = streams && inputs.size() > 1;
+    if (g_strcmp0(detect_regions, "frame") != 0 && !motion_regions() && !tiled_regions()) {
+        g_printerr("Unknown --detect-regions %s\n", detect_regions);
+        return 1;
+    }
+    // Tiles have to advance, an overlap of a whole tile would give a tile per pixel
+    if (tiled_regions() && (tile_width <= 0 || tile_height <= 0 || tile_overlap < 0 ||
+                            tile_overlap >= std::min(tile_width, tile_height))) {
+        g_printerr("--tile-width and --tile-height have to be positive and --tile-overlap from 0 to below both\n");
+        return 1;
+    }
+    // Motion regions are found with the block comparison of the static scene gate
+    if (motion_regions() && static_threshold <= 0)
+        static_threshold = 6;
+    if (gated_detection() && detect_interval > 1) {
+        g_printerr("--static-threshold and --detect-regions can't be combined with --detect-interval\n");
+        return 1;
+    }
+    // Batches are filled across streams, by default with one frame of every stream
+    if (batch_size <= 0 && tiled_regions() && !multi_stream) {
+        // All tiles of a frame go into one batch
+        batch_size = (gint)TileFrame(input_width, input_height, tile_width, tile_height, tile_overlap).size();
+    }
+    if (batch_size <= 0)
+        batch_size = multi_stream ? (gint)inputs.size() : 1;
+
+    std::unique_ptr<PipelineStats> stats;
+    if (stats_file) {
+        stats.reset(new PipelineStats(stats_file, stats_interval));
+        pipeline_stats = stats.get();
+    }
+    std::unique_ptr<MetricsServer> metrics;
+    if (metrics_address) {
+        try {
+            metrics.reset(new MetricsServer(metrics_address));
+        } catch (const std::exception &e) {
+            g_printerr("%s\n", e.what());
+            return 1;
+        }
+        metrics_server = metrics.get();
+    }
+
+    if (server_socket || spool_dir)
+        return run_jobs({});
+    // Several inputs go one after another through a pipeline per worker, with one output file each
+    if (inputs.size() > 1 && !multi_stream) {
+        if (workers <= 0)
+            workers = g_get_num_processors();
+        return run_jobs(inputs);
+    }
+
     gchar const *sink;
 
 #if ENABLE_ARSEI_INSERTION
     if (h264_compression_scheme == FALSE) {
-      enc_str = "msdkh265enc name=msdkh265enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
       sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_with_sei.h265";
     }
     else {
-      enc_str = "msdkh264enc name=msdkh264enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
       sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_with_sei.h264";
     }
 #else
     if (h264_compression_scheme == FALSE) {
-      enc_str = "msdkh265enc name=msdkh265enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
       sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_without_sei.h265";
     }
     else {
-      enc_str = "msdkh264enc name=msdkh264enc rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
       sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false" : "filesink location=output/msdk_encoded_without_sei.h264";
     }
 #endif
 
     // Build the pipeline
-    auto launch_str = g_strdup_printf("%s=%s num_buffers=300 ! %s !"
-                                      " gvadetect model=%s device=%s batch-size=%d ! gvatrack !"
-                                      " %s ! %s",
-                                      video_source, input_file, preprocess_pipeline, detection_model, device, batch_size, enc_str, sink);
-
-    g_print("PIPELINE: %s \n", launch_str);
-    GstElement *pipeline = gst_parse_launch(launch_str, NULL);
-    g_free(launch_str);
-
-#if ENABLE_ARSEI_INSERTION
-    if (h264_compression_scheme == TRUE) {
-      // set probe callback
-      auto msdkh264enc = gst_bin_get_by_name(GST_BIN(pipeline), "msdkh264enc");
-      auto pad = gst_element_get_static_pad(msdkh264enc, "sink");
-      // The provided callback 'pad_probe_callback' is called for every state that
-      // matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-      gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, NULL, NULL);
-      gst_object_unref(pad);
-    }
-    
-    else {
-      // set probe callback
-      auto msdkh265enc = gst_bin_get_by_name(GST_BIN(pipeline), "msdkh265enc");
-      auto pad = gst_element_get_static_pad(msdkh265enc, "sink");
-      // The provided callback 'pad_probe_callback' is called for every state that
-      // matches GST_PAD_PROBE_TYPE_BUFFER to probe buffers
-      gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, pad_probe_callback, NULL, NULL);
-      gst_object_unref(pad);
+    std::vector<std::unique_ptr<BoxSmoother>> box_smoothers;
+    std::vector<std::unique_ptr<DetectionGate>> gates;
+    GstElement *pipeline;
+    if (multi_stream) {
+        pipeline = create_streams_pipeline(inputs, h264_compression_scheme, box_smoothers, gates);
+    } else {
+        if (box_log_file || box_reference_file)
+            box_log = new BoxLog();
+        box_smoothers.emplace_back(new BoxSmoother(box_grid, box_alpha, box_hysteresis));
+        gates.emplace_back(new DetectionGate());
+        pipeline = create_pipeline(video_source, input_file, h264_compression_scheme, sink, box_smoothers.back().get(),
+                                   gates.back().get());
     }
-#endif
+
+    struct rusage usage_start;
+    getrusage(RUSAGE_SELF, &usage_start);
+    gint64 start_time = g_get_monotonic_time();
 
     // Start playing
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
@@ -326,10 +845,24 @@ int main(int argc, char *argv[]) {
     if (msg)
         gst_message_unref(msg);
 
+    print_run_report(g_get_monotonic_time() - start_time, usage_start);
+
+    std::vector<const BoxSmoother *> box_stats;
+    for (const auto &box_smoother : box_smoothers)
+        box_stats.push_back(box_smoother.get());
+    print_box_stats(box_stats);
+    std::vector<const DetectionGate *> gate_stats;
+    for (const auto &gate : gates)
+        gate_stats.push_back(gate.get());
+    print_detection_stats(gate_stats);
+    if (pipeline_stats && !pipeline_stats->Write())
+        g_printerr("Can't write statistics to %s\n", stats_file);
+
     // Free resources
     gst_object_unref(bus);
     gst_element_set_state(pipeline, GST_STATE_NULL);
     gst_object_unref(pipeline);
+    delete box_log;
 
     return ret_code;
 }
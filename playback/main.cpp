@@ -8,17 +8,21 @@
 #include <dirent.h>
 #include <gio/gio.h>
 #include <gst/gst.h>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "gst/videoanalytics/video_frame.h"
+#include "pipeline_stats.h"
 
 using namespace std;
 
 gchar const *input_file = NULL;
 gboolean no_display = FALSE;
 gchar const *comp_scheme = NULL;
+gchar const *stats_file = NULL;
+gint stats_interval = 0;
 
 // This structure will be used to pass user data (such as memory type) to the
 // callback function.
@@ -26,6 +30,11 @@ static GOptionEntry opt_entries[] = {
     {"input", 'i', 0, G_OPTION_ARG_STRING, &input_file, "Path to input video file", NULL},
     {"compression", 'c', 0, G_OPTION_ARG_STRING, &comp_scheme, "Compression scheme of input file", NULL},    
     {"no-display", 'n', 0, G_OPTION_ARG_NONE, &no_display, "Run without display", NULL},   
+    {"stats", 0, 0, G_OPTION_ARG_STRING, &stats_file,
+     "Write per-element latencies, queue levels, frame latency and fps as JSON to this file ('-' for stdout)",
+     NULL},
+    {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval,
+     "Rewrite the --stats file every that many seconds while running (0: at the end only)", NULL},
     GOptionEntry()};
 
 
@@ -99,6 +108,12 @@ int main(int argc, char *argv[]) {
     GstElement *pipeline = gst_parse_launch(launch_str, NULL);
     g_free(launch_str);
 
+    std::unique_ptr<PipelineStats> pipeline_stats;
+    if (stats_file) {
+        pipeline_stats.reset(new PipelineStats(stats_file, stats_interval));
+        pipeline_stats->Attach(pipeline);
+    }
+
     // Start playing
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
 
@@ -124,6 +139,9 @@ int main(int argc, char *argv[]) {
     if (msg)
         gst_message_unref(msg);
 
+    if (pipeline_stats && !pipeline_stats->Write())
+        g_printerr("Can't write statistics to %s\n", stats_file);
+
     // Free resources
     gst_object_unref(bus);
     gst_element_set_state(pipeline, GST_STATE_NULL);
@@ -0,0 +1,255 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include "arsei_injector.h"
+
+#include <algorithm>
+#include <cstring>
+#include <gst/video/gstvideometa.h>
+
+// Entries of the label and object arrays of GstH26XAnnotatedRegions
+#define MAX_AR_ENTRIES 250
+// Frames the encoder dropped are forgotten once this many others are waiting
+#define MAX_PENDING_FRAMES 256
+
+bool ArseiInjector::Object::SameAs(const Object &sent) const {
+    return x == sent.x && y == sent.y && w == sent.w && h == sent.h && label == sent.label && partial == sent.partial;
+}
+
+ArseiInjector::ArseiInjector(bool h265) : h265(h265) {
+    if (h265) {
+        h265_parser = gst_h265_parser_new();
+        sei_messages = g_array_new(FALSE, FALSE, sizeof(GstH265SEIMessage));
+    } else {
+        h264_parser = gst_h264_nal_parser_new();
+        sei_messages = g_array_new(FALSE, FALSE, sizeof(GstH264SEIMessage));
+    }
+}
+
+ArseiInjector::~ArseiInjector() {
+    if (h265_parser)
+        gst_h265_parser_free(h265_parser);
+    if (h264_parser)
+        gst_h264_nal_parser_free(h264_parser);
+    g_array_free(sei_messages, TRUE);
+}
+
+void ArseiInjector::Attach(GstElement *encoder) {
+    GstPad *sink_pad = gst_element_get_static_pad(encoder, "sink");
+    GstPad *src_pad = gst_element_get_static_pad(encoder, "src");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, FrameIn, this, NULL);
+    gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, AccessUnitOut, this, NULL);
+    gst_object_unref(sink_pad);
+    gst_object_unref(src_pad);
+}
+
+// The encoders drop the region metas, so they are kept until the access unit of the frame
+GstPadProbeReturn ArseiInjector::FrameIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    ArseiInjector *injector = static_cast<ArseiInjector *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    Regions regions;
+    gpointer state = NULL;
+    GstMeta *meta;
+    while ((meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+        GstVideoRegionOfInterestMeta *roi = (GstVideoRegionOfInterestMeta *)meta;
+        GstStructure *s = gst_video_region_of_interest_meta_get_param(roi, "roi/arsei");
+        gint obj_id;
+        if (!s || !gst_structure_get_int(s, "obj_id", &obj_id) || obj_id < 0 || obj_id >= MAX_AR_ENTRIES)
+            continue;
+        // Boxes are written with 16 bits
+        if (roi->x > G_MAXUINT16 || roi->y > G_MAXUINT16 || roi->w > G_MAXUINT16 || roi->h > G_MAXUINT16)
+            continue;
+        Object object;
+        object.x = roi->x;
+        object.y = roi->y;
+        object.w = roi->w;
+        object.h = roi->h;
+        const gchar *label = gst_structure_get_string(s, "label");
+        if (label)
+            object.label = label;
+        // Confidence in [0, 1] as fixed point of conf_length bits
+        gdouble confidence;
+        gint conf_length;
+        object.confidence = 0;
+        if (gst_structure_get_double(s, "confidence", &confidence) &&
+            gst_structure_get_int(s, "conf_length", &conf_length) && conf_length >= 1 && conf_length <= 16) {
+            regions.conf_length = conf_length;
+            object.confidence = (guint)(CLAMP(confidence, 0.0, 1.0) * ((1 << conf_length) - 1) + 0.5);
+        }
+        gboolean partial;
+        object.partial = false;
+        if (gst_structure_get_boolean(s, "partial", &partial)) {
+            regions.partial = true;
+            object.partial = partial;
+        }
+        regions.objects[obj_id] = object;
+    }
+
+    std::lock_guard<std::mutex> lock(injector->mutex);
+    if (injector->pending.size() >= MAX_PENDING_FRAMES)
+        injector->pending.erase(injector->pending.begin());
+    injector->pending[GST_BUFFER_PTS(buffer)] = std::move(regions);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn ArseiInjector::AccessUnitOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    (void)pad;
+    ArseiInjector *injector = static_cast<ArseiInjector *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    Regions regions;
+    {
+        std::lock_guard<std::mutex> lock(injector->mutex);
+        auto it = injector->pending.find(GST_BUFFER_PTS(buffer));
+        if (it == injector->pending.end())
+            return GST_PAD_PROBE_OK;
+        regions = std::move(it->second);
+        injector->pending.erase(it);
+    }
+    injector->num_frames++;
+    if (!injector->AddMessages(regions, !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)))
+        return GST_PAD_PROBE_OK;
+
+    GstBuffer *with_sei = injector->Insert(buffer);
+    if (with_sei) {
+        gst_buffer_unref(buffer);
+        GST_PAD_PROBE_INFO_DATA(info) = with_sei;
+    } else if (!injector->warned) {
+        g_printerr("Can't insert the AR SEI into the output of the encoder\n");
+        injector->warned = true;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+template <typename Message>
+static Message &NewMessage(GArray *messages, int payload_type) {
+    g_array_set_size(messages, messages->len + 1);
+    Message &message = g_array_index(messages, Message, messages->len - 1);
+    memset(&message, 0, sizeof(Message));
+    message.payloadType = (decltype(message.payloadType))payload_type;
+    return message;
+}
+
+// Fills the annotated regions of either codec, the structures only differ in name
+template <typename AnnotatedRegions, typename Update>
+static void FillRegions(AnnotatedRegions &ar, bool partial, guint conf_length, const std::vector<Update> &updates,
+                        const std::vector<std::string> &labels, size_t first_label) {
+    ar.object_label_present_flag = !labels.empty();
+    ar.partial_object_flag_present_flag = partial;
+    ar.object_conf_info_present_flag = conf_length > 0;
+    ar.object_conf_length = conf_length;
+    // Like the msdk encoders, labels[i] holds the i-th label update
+    ar.num_labels = labels.size();
+    ar.num_label_updates = labels.size() - first_label;
+    for (size_t i = first_label; i < labels.size(); i++)
+        g_strlcpy(ar.labels[i - first_label].label, labels[i].c_str(), sizeof(ar.labels[0].label));
+    ar.num_object_updates = updates.size();
+    for (size_t i = 0; i < updates.size(); i++) {
+        auto &object = ar.objects[i];
+        object.object_idx = updates[i].id;
+        object.object_cancel_flag = updates[i].cancel;
+        if (updates[i].cancel)
+            continue;
+        object.object_label_idx = updates[i].label_idx;
+        object.bounding_box_update_flag = 1;
+        object.bounding_box_top = updates[i].object.y;
+        object.bounding_box_left = updates[i].object.x;
+        object.bounding_box_width = updates[i].object.w;
+        object.bounding_box_height = updates[i].object.h;
+        object.partial_object_flag = updates[i].object.partial;
+        object.object_confidence = updates[i].object.confidence;
+    }
+}
+
+bool ArseiInjector::AddMessages(const Regions &regions, bool sync_point) {
+    g_array_set_size(sei_messages, 0);
+
+    // A key frame may be where a decoder joins or the stream is cut: cancel and send all again.
+    // The first one as well, the output may be appended to another stream.
+    bool cancel = sync_point && (active || num_frames == 1);
+    if (cancel) {
+        sent.clear();
+        labels_sent = 0;
+        active = false;
+    }
+
+    std::vector<Update> updates;
+    for (const auto &entry : regions.objects) {
+        const Object &object = entry.second;
+        auto it = sent.find(entry.first);
+        if (it != sent.end() && object.SameAs(it->second))
+            continue;
+        guint label_idx = 0;
+        if (!object.label.empty()) {
+            auto label = std::find(labels.begin(), labels.end(), object.label);
+            if (label == labels.end()) {
+                if (labels.size() >= MAX_AR_ENTRIES) {
+                    if (!warned)
+                        g_printerr("More than %d labels, objects with new labels are left out\n", MAX_AR_ENTRIES);
+                    warned = true;
+                    continue;
+                }
+                label = labels.insert(labels.end(), object.label);
+            }
+            label_idx = label - labels.begin();
+        }
+        updates.push_back({entry.first, false, object, label_idx});
+        sent[entry.first] = object;
+    }
+    // Objects gone since the last message
+    for (auto it = sent.begin(); it != sent.end();) {
+        if (regions.objects.count(it->first) == 0) {
+            updates.push_back({it->first, true, it->second, 0});
+            it = sent.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (cancel) {
+        if (h265)
+            NewMessage<GstH265SEIMessage>(sei_messages, GST_H265_SEI_ANNOTATED_REGIONS)
+                .payload.annotated_regions.cancel_flag = 1;
+        else
+            NewMessage<GstH264SEIMessage>(sei_messages, GST_H264_SEI_ANNOTATED_REGIONS)
+                .payload.annotated_regions.cancel_flag = 1;
+    }
+    if (!updates.empty() || labels_sent < labels.size()) {
+        if (h265)
+            FillRegions(
+                NewMessage<GstH265SEIMessage>(sei_messages, GST_H265_SEI_ANNOTATED_REGIONS).payload.annotated_regions,
+                regions.partial, regions.conf_length, updates, labels, labels_sent);
+        else
+            FillRegions(
+                NewMessage<GstH264SEIMessage>(sei_messages, GST_H264_SEI_ANNOTATED_REGIONS).payload.annotated_regions,
+                regions.partial, regions.conf_length, updates, labels, labels_sent);
+        labels_sent = labels.size();
+        num_object_updates += updates.size();
+        active = true;
+    }
+    return sei_messages->len > 0;
+}
+
+GstBuffer *ArseiInjector::Insert(GstBuffer *access_unit) {
+    GstMemory *memory =
+        h265 ? gst_h265_create_sei_memory(0, 1, 4, sei_messages) : gst_h264_create_sei_memory(4, sei_messages);
+    if (!memory)
+        return NULL;
+    GstBuffer *with_sei = h265 ? gst_h265_parser_insert_sei(h265_parser, access_unit, memory)
+                               : gst_h264_parser_insert_sei(h264_parser, access_unit, memory);
+    if (with_sei) {
+        num_messages += sei_messages->len;
+        num_sei_bytes += gst_memory_get_sizes(memory, NULL, NULL);
+    }
+    gst_memory_unref(memory);
+    return with_sei;
+}
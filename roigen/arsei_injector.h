@@ -0,0 +1,92 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#pragma once
+
+#include <gst/codecparsers/gsth264parser.h>
+#include <gst/codecparsers/gsth265parser.h>
+#include <gst/gst.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Writes the annotated regions SEI for encoders that don't, such as x264enc and x265enc, with
+// the patched codecparsers. The "roi/arsei" parameters of the regions of every input frame
+// (obj_id, label, confidence with conf_length, partial) become an SEI in front of the first
+// slice of its access unit, with only the objects that changed or disappeared and the labels
+// not sent yet, as the patched msdk encoders write it. Key frames start with a cancel and send
+// everything again.
+class ArseiInjector {
+  public:
+    explicit ArseiInjector(bool h265);
+    ~ArseiInjector();
+
+    // Installs the probes on the encoder, which has to output Annex-B access units
+    void Attach(GstElement *encoder);
+
+    guint64 frames() const {
+        return num_frames;
+    }
+    guint64 messages() const {
+        return num_messages;
+    }
+    guint64 sei_bytes() const {
+        return num_sei_bytes;
+    }
+    guint64 object_updates() const {
+        return num_object_updates;
+    }
+
+  private:
+    struct Object {
+        int x, y, w, h;
+        std::string label;
+        guint confidence;
+        bool partial;
+        // True if the decoder needs no update, a confidence change alone doesn't count
+        bool SameAs(const Object &sent) const;
+    };
+    struct Regions {
+        std::map<int, Object> objects; // by obj_id
+        bool partial = false;
+        guint conf_length = 0; // 0 without confidence
+    };
+    // What one message carries, independent of the codec
+    struct Update {
+        int id;
+        bool cancel;
+        Object object;
+        guint label_idx;
+    };
+
+    static GstPadProbeReturn FrameIn(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn AccessUnitOut(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    // Fills sei_messages for the access unit, returns false if it gets none
+    bool AddMessages(const Regions &regions, bool sync_point);
+    GstBuffer *Insert(GstBuffer *access_unit);
+
+    bool h265;
+    GstH264NalParser *h264_parser = NULL;
+    GstH265Parser *h265_parser = NULL;
+    GArray *sei_messages; // GstH264SEIMessage or GstH265SEIMessage, reused
+
+    // Regions of the frames inside the encoder by timestamp
+    std::mutex mutex;
+    std::map<GstClockTime, Regions> pending;
+
+    // What the decoder knows, only used on the streaming thread of the src pad
+    std::map<int, Object> sent;
+    std::vector<std::string> labels;
+    size_t labels_sent = 0;
+    bool active = false;
+    bool warned = false;
+
+    guint64 num_frames = 0;
+    guint64 num_messages = 0;
+    guint64 num_sei_bytes = 0;
+    guint64 num_object_updates = 0;
+};
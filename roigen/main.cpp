@@ -0,0 +1,233 @@
+/*******************************************************************************
+ * Copyright (C) 2018-2020 Intel Corporation
+ *
+ * SPDX-License-Identifier: MIT
+ ******************************************************************************/
+
+#include <gst/gst.h>
+#include <memory>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+
+#include "arsei_injector.h"
+#include "metrics_server.h"
+#include "pipeline_stats.h"
+#include "roi_generator.h"
+
+// Regions the patched msdk encoders keep, mfxExtAnnotatedRegionsSEI::Objs and ::Labels
+#define MAX_MSDK_REGIONS 50
+// Regions the patched codecparsers write
+#define MAX_SEI_REGIONS 250
+
+gchar const *comp_scheme = NULL;
+gchar const *encoder_type = "software";
+gint width = 3840;
+gint height = 2160;
+gint framerate = 60;
+gint num_frames = 600;
+gboolean no_display = FALSE;
+gchar const *stats_file = NULL;
+gint stats_interval = 0;
+gchar const *metrics_address = NULL;
+RoiGeneratorConfig roigen;
+
+static GOptionEntry opt_entries[] = {
+    {"compression", 'c', 0, G_OPTION_ARG_STRING, &comp_scheme, "Compression scheme of the output, h264 or h265", NULL},
+    {"encoder", 'e', 0, G_OPTION_ARG_STRING, &encoder_type,
+     "software (x264enc / x265enc with the AR SEI written by the sample) or msdk (the patched msdk encoders)", NULL},
+    {"width", 0, 0, G_OPTION_ARG_INT, &width, "Frame width", NULL},
+    {"height", 0, 0, G_OPTION_ARG_INT, &height, "Frame height", NULL},
+    {"framerate", 0, 0, G_OPTION_ARG_INT, &framerate, "Frames per second of the test video", NULL},
+    {"frames", 0, 0, G_OPTION_ARG_INT, &num_frames, "Number of frames", NULL},
+    {"objects", 0, 0, G_OPTION_ARG_INT, &roigen.objects, "Object slots, all filled in the first frame", NULL},
+    {"seed", 0, 0, G_OPTION_ARG_INT, &roigen.seed, "Seed of the random walk", NULL},
+    {"speed", 0, 0, G_OPTION_ARG_DOUBLE, &roigen.speed, "Largest movement of an object in pixels per frame", NULL},
+    {"appear", 0, 0, G_OPTION_ARG_DOUBLE, &roigen.appear,
+     "Probability per frame that a free slot gets a new object", NULL},
+    {"disappear", 0, 0, G_OPTION_ARG_DOUBLE, &roigen.disappear, "Probability per frame that an object disappears",
+     NULL},
+    {"label-churn", 0, 0, G_OPTION_ARG_DOUBLE, &roigen.label_churn,
+     "Probability per frame that an object changes its label", NULL},
+    {"labels", 0, 0, G_OPTION_ARG_INT, &roigen.labels, "Distinct labels, 0 for objects without label", NULL},
+    {"conf-bits", 0, 0, G_OPTION_ARG_INT, &roigen.conf_bits, "Bits of the confidence, 0 for none", NULL},
+    {"no-display", 'n', 0, G_OPTION_ARG_NONE, &no_display, "Discard the output instead of writing it", NULL},
+    {"stats", 0, 0, G_OPTION_ARG_STRING, &stats_file,
+     "Write per-element latencies, queue levels, frame latency and fps as JSON to this file ('-' for stdout)",
+     NULL},
+    {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval,
+     "Rewrite the --stats file every that many seconds while running (0: at the end only)", NULL},
+    {"metrics", 0, 0, G_OPTION_ARG_STRING, &metrics_address,
+     "Serve Prometheus metrics over HTTP on [HOST:]PORT (127.0.0.1 by default) or a UNIX socket path", NULL},
+    GOptionEntry()};
+
+static std::string encoder_str(bool software, bool h264_compression_scheme) {
+    if (software) {
+        if (h264_compression_scheme)
+            return "x264enc name=encoder speed-preset=ultrafast key-int-max=30 ! "
+                   "video/x-h264,stream-format=byte-stream,alignment=au ! h264parse";
+        return "x265enc name=encoder speed-preset=ultrafast key-int-max=30 ! "
+               "video/x-h265,stream-format=byte-stream,alignment=au ! h265parse";
+    }
+    if (!h264_compression_scheme)
+        return "msdkh265enc name=encoder rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h265,profile=main ! h265parse";
+    return "msdkh264enc name=encoder rate-control=cqp qpi=28 qpp=28 gop-size=30 num-slices=1 ref-frames=1 b-frames=0 target-usage=4 hardware=true ! video/x-h264,profile=main ! h264parse";
+}
+
+static double cpu_seconds(const struct rusage &usage) {
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Generates moving regions on test video and encodes them with AR SEI, to stress the SEI path
+// without models, real video or, with the software encoders, an Intel GPU
+int main(int argc, char *argv[]) {
+    // Parse arguments
+    GOptionContext *context = g_option_context_new("roigen");
+    g_option_context_add_main_entries(context, opt_entries, "roigen");
+    g_option_context_add_group(context, gst_init_get_option_group());
+    GError *error = NULL;
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_print("option parsing failed: %s\n", error->message);
+        return 1;
+    }
+
+    gboolean h264_compression_scheme = !comp_scheme || std::string(comp_scheme).find("h265") == std::string::npos;
+    bool software = std::string(encoder_type) != "msdk";
+    if (software && std::string(encoder_type) != "software") {
+        g_printerr("--encoder is software or msdk\n");
+        return 1;
+    }
+    // The msdk encoders keep fewer objects and labels
+    int max_regions = software ? MAX_SEI_REGIONS : MAX_MSDK_REGIONS;
+    if (roigen.objects < 1 || roigen.objects > max_regions || roigen.labels < 0 || roigen.labels > max_regions) {
+        g_printerr("--objects 1 - %d and --labels 0 - %d with the %s encoders\n", max_regions, max_regions,
+                   encoder_type);
+        return 1;
+    }
+    if (width < 64 || height < 64 || framerate < 1 || num_frames < 1 || roigen.conf_bits < 0 || roigen.conf_bits > 16) {
+        g_printerr("Invalid frame size, frame rate, frame count or confidence bits\n");
+        return 1;
+    }
+
+    std::unique_ptr<MetricsServer> metrics;
+    if (metrics_address) {
+        try {
+            metrics.reset(new MetricsServer(metrics_address));
+        } catch (const std::exception &e) {
+            g_printerr("%s\n", e.what());
+            return 1;
+        }
+    }
+
+    gchar const *extension = h264_compression_scheme ? "h264" : "h265";
+    std::string sink = no_display ? "identity signal-handoffs=false ! fakesink sync=false"
+                                  : std::string("filesink location=output/roigen_") + encoder_type + "." + extension;
+
+    // The software encoders take I420, the msdk ones NV12
+    auto launch_str = g_strdup_printf("videotestsrc pattern=ball num-buffers=%d ! "
+                                      "video/x-raw,format=%s,width=%d,height=%d,framerate=%d/1 ! "
+                                      "identity name=roigen ! %s ! %s",
+                                      num_frames, software ? "I420" : "NV12", width, height, framerate,
+                                      encoder_str(software, h264_compression_scheme).c_str(), sink.c_str());
+    g_print("PIPELINE: %s \n", launch_str);
+    GstElement *pipeline = gst_parse_launch(launch_str, NULL);
+    g_free(launch_str);
+
+    RoiGenerator generator(roigen);
+    GstElement *roigen_element = gst_bin_get_by_name(GST_BIN(pipeline), "roigen");
+    GstPad *pad = gst_element_get_static_pad(roigen_element, "src");
+    generator.Attach(pad);
+    gst_object_unref(pad);
+    gst_object_unref(roigen_element);
+
+    // Before the metrics, so that they see the SEI
+    std::unique_ptr<ArseiInjector> injector;
+    if (software) {
+        injector.reset(new ArseiInjector(!h264_compression_scheme));
+        GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+        injector->Attach(encoder);
+        gst_object_unref(encoder);
+    }
+    if (metrics)
+        metrics->Attach(pipeline, {{"roigen", {}, "encoder", !h264_compression_scheme}});
+
+    std::unique_ptr<PipelineStats> pipeline_stats;
+    if (stats_file) {
+        pipeline_stats.reset(new PipelineStats(stats_file, stats_interval));
+        pipeline_stats->Attach(pipeline);
+    }
+
+    struct rusage usage_start;
+    getrusage(RUSAGE_SELF, &usage_start);
+    gint64 start_time = g_get_monotonic_time();
+
+    // Start playing
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Wait until error or EOS, keeping the last AR SEI figures of the msdk encoders
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstStructure *arsei_stats = NULL;
+    int ret_code = 0;
+    GstMessage *msg;
+    while ((msg = gst_bus_poll(bus, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ELEMENT),
+                               -1))) {
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ELEMENT) {
+            const GstStructure *s = gst_message_get_structure(msg);
+            if (s && gst_structure_has_name(s, "arsei-stats")) {
+                if (arsei_stats)
+                    gst_structure_free(arsei_stats);
+                arsei_stats = gst_structure_copy(s);
+            }
+            gst_message_unref(msg);
+            continue;
+        }
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+            GError *err = NULL;
+            gchar *dbg_info = NULL;
+
+            gst_message_parse_error(msg, &err, &dbg_info);
+            g_printerr("ERROR from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
+            g_printerr("Debugging info: %s\n", (dbg_info) ? dbg_info : "none");
+
+            g_error_free(err);
+            g_free(dbg_info);
+            ret_code = -1;
+        }
+        gst_message_unref(msg);
+        break;
+    }
+
+    struct rusage usage_end;
+    getrusage(RUSAGE_SELF, &usage_end);
+    double seconds = (g_get_monotonic_time() - start_time) / 1e6;
+    guint64 frames = generator.frames();
+    g_print("%" G_GUINT64_FORMAT " frames %dx%d in %.2f s (%.1f fps), %.2f ms CPU per frame\n", frames, width, height,
+            seconds, seconds > 0 ? frames / seconds : 0.0,
+            frames ? (cpu_seconds(usage_end) - cpu_seconds(usage_start)) * 1000 / frames : 0.0);
+    g_print("Regions: %.1f per frame, %" G_GUINT64_FORMAT " appeared, disappeared or relabeled\n",
+            frames ? (double)generator.regions() / frames : 0.0, generator.changes());
+    if (injector) {
+        guint64 encoded = injector->frames();
+        g_print("AR SEI: %" G_GUINT64_FORMAT " messages, %" G_GUINT64_FORMAT " bytes (%.1f per frame), %.1f object "
+                "updates per frame\n",
+                injector->messages(), injector->sei_bytes(), encoded ? (double)injector->sei_bytes() / encoded : 0.0,
+                encoded ? (double)injector->object_updates() / encoded : 0.0);
+    }
+    if (arsei_stats) {
+        gchar *text = gst_structure_to_string(arsei_stats);
+        g_print("AR SEI: %s\n", text);
+        g_free(text);
+        gst_structure_free(arsei_stats);
+    }
+    if (pipeline_stats && !pipeline_stats->Write())
+        g_printerr("Can't write statistics to %s\n", stats_file);
+
+    // Free resources
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    return ret_code;
+}